@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "batch.h"
+#include "decode.h"
+#include "opcodes.h"
+
+#define BATCH_BUFFER (1 << 20) // bytes of listing collected before each write
+#define BATCH_LINE 40 // longest line the formatter produces, address and mnemonic included
+
+typedef struct fmt_entry { // how to print one opcode
+	char text[24]; // mnemonic up to the operand
+	uint8_t text_len;
+	uint8_t size;
+	uint8_t operand;
+} fmt_entry;
+
+static fmt_entry fmt_table[256];
+static char hex_lower[256][2];
+static char hex_upper[256][2];
+static pthread_once_t fmt_once = PTHREAD_ONCE_INIT;
+
+// Copies the mnemonics, sizes and operand styles out of the opcode table with their lengths
+// precomputed, alongside the two hex digit strings of every byte value
+static void init_fmt_table() {
+	static const char digits_lower[] = "0123456789abcdef";
+	static const char digits_upper[] = "0123456789ABCDEF";
+	for (int v = 0; v < 256; v++) {
+		hex_lower[v][0] = digits_lower[v >> 4];
+		hex_lower[v][1] = digits_lower[v & 0xf];
+		hex_upper[v][0] = digits_upper[v >> 4];
+		hex_upper[v][1] = digits_upper[v & 0xf];
+	}
+	for (int op = 0; op < 256; op++) {
+		const op_info* info = &op_table[op];
+		fmt_entry* e = &fmt_table[op];
+		e->size = info->size;
+		e->operand = info->operand;
+		e->text_len = strlen(info->name);
+		memcpy(e->text, info->name, e->text_len);
+		if (e->operand == OPND_D8 || e->operand == OPND_D16) {
+			memcpy(e->text + e->text_len, "#$", 2);
+			e->text_len += 2;
+		} else if (e->operand == OPND_ADDR) {
+			e->text[e->text_len++] = '$';
+		}
+	}
+}
+
+// Formats the instruction at code[pc] as a listing line into p, returns the line length
+static int format_line(char* p, const BYTE* code, long pc) {
+	char* start = p;
+	if (pc > 0xffff) { // listings of images beyond 64K keep counting up
+		p += sprintf(p, "%lX", pc >> 16);
+	}
+	p[0] = hex_upper[(pc >> 8) & 0xff][0];
+	p[1] = hex_upper[(pc >> 8) & 0xff][1];
+	p[2] = hex_upper[pc & 0xff][0];
+	p[3] = hex_upper[pc & 0xff][1];
+	p[4] = ' ';
+	p += 5;
+	const fmt_entry* e = &fmt_table[code[0]];
+	memcpy(p, e->text, e->text_len);
+	p += e->text_len;
+	switch (e->operand) {
+		case OPND_D8: memcpy(p, hex_lower[code[1]], 2); p += 2; break;
+		case OPND_D16: memcpy(p, hex_lower[code[2]], 2); memcpy(p+2, hex_lower[code[1]], 2); p += 4; break;
+		case OPND_ADDR: memcpy(p, hex_upper[code[2]], 2); memcpy(p+2, hex_upper[code[1]], 2); p += 4; break;
+	}
+	*p++ = '\n';
+	return p - start;
+}
+
+// Writes all of buf to fd, returns 1 on success
+static int write_all(int fd, const char* buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n <= 0) {
+			return 0;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+// Disassembles the file at path into out_path, returns 1 on success
+static int disassemble_file(const char* path, const char* out_path, char* buf) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return 0;
+	}
+	long numbytes = st.st_size;
+	const BYTE* image = NULL;
+	if (numbytes > 0) {
+		image = mmap(NULL, numbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (image == MAP_FAILED) {
+			close(fd);
+			return 0;
+		}
+		madvise((void*) image, numbytes, MADV_SEQUENTIAL);
+	}
+	close(fd);
+
+	int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	int ok = out >= 0;
+	size_t used = 0;
+	long pc = 0;
+	while (ok && pc < numbytes) {
+		BYTE tail[3] = {0, 0, 0}; // operands cut off by the end of the file read as zero, like the normal listing
+		const BYTE* code = &image[pc];
+		if (pc + 3 > numbytes) {
+			memcpy(tail, code, numbytes - pc);
+			code = tail;
+		}
+		used += format_line(buf + used, code, pc);
+		pc += fmt_table[code[0]].size;
+		if (used > BATCH_BUFFER - BATCH_LINE) {
+			ok = write_all(out, buf, used);
+			used = 0;
+		}
+	}
+	ok = ok && write_all(out, buf, used);
+	if (out >= 0) {
+		ok = (close(out) == 0) && ok;
+	}
+	if (image != NULL) {
+		munmap((void*) image, numbytes);
+	}
+	return ok;
+}
+
+// Returns the part of path after the last '/'
+static const char* base_name(const char* path) {
+	const char* base = strrchr(path, '/');
+	return base ? base + 1 : path;
+}
+
+static int by_base_name(const void* x, const void* y) {
+	return strcmp(base_name(*(char* const*) x), base_name(*(char* const*) y));
+}
+
+// Returns 1 if two of the files have the same basename, so their listings would go to the same
+// output file, and names the first such pair on stderr
+static int duplicate_names(char** files, int num_files, const char* out_dir) {
+	char** sorted = malloc(num_files * sizeof(char*));
+	if (sorted == NULL) {
+		return 1;
+	}
+	memcpy(sorted, files, num_files * sizeof(char*));
+	qsort(sorted, num_files, sizeof(char*), by_base_name);
+	int found = 0;
+	for (int i = 1; i < num_files && !found; i++) {
+		if (strcmp(base_name(sorted[i-1]), base_name(sorted[i])) == 0) {
+			fprintf(stderr, "%s and %s would both be written to %s/%s.txt\n", sorted[i-1], sorted[i], out_dir, base_name(sorted[i]));
+			found = 1;
+		}
+	}
+	free(sorted);
+	return found;
+}
+
+typedef struct batch_job { // files shared between the worker threads
+	char** files;
+	int num_files;
+	const char* out_dir;
+	int next; // next file to take, protected by lock
+	int failures;
+	pthread_mutex_t lock;
+} batch_job;
+
+static void* batch_worker(void* arg) {
+	batch_job* job = arg;
+	char* buf = malloc(BATCH_BUFFER);
+	char out_path[4096];
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		int i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->num_files) {
+			break;
+		}
+		snprintf(out_path, sizeof(out_path), "%s/%s.txt", job->out_dir, base_name(job->files[i]));
+		if (buf == NULL || !disassemble_file(job->files[i], out_path, buf)) {
+			fprintf(stderr, "Could not disassemble %s\n", job->files[i]);
+			pthread_mutex_lock(&job->lock);
+			job->failures++;
+			pthread_mutex_unlock(&job->lock);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+int batch_disassemble(char** files, int num_files, const char* out_dir, int threads) {
+	pthread_once(&fmt_once, init_fmt_table);
+	if (duplicate_names(files, num_files, out_dir)) {
+		return num_files; // nothing is written rather than one listing silently replacing another
+	}
+	if (threads < 1) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (threads > num_files) {
+		threads = num_files;
+	}
+	batch_job job = {.files = files, .num_files = num_files, .out_dir = out_dir};
+	pthread_mutex_init(&job.lock, NULL);
+	pthread_t* workers = malloc(threads * sizeof(pthread_t));
+	int started = 0;
+	for (; started < threads; started++) {
+		if (pthread_create(&workers[started], NULL, batch_worker, &job) != 0) {
+			break;
+		}
+	}
+	if (started == 0) {
+		batch_worker(&job); // no threads available, do the work here
+	}
+	for (int t = 0; t < started; t++) {
+		pthread_join(workers[t], NULL);
+	}
+	free(workers);
+	pthread_mutex_destroy(&job.lock);
+	return job.failures;
+}
@@ -0,0 +1,11 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Disassembles each of the num_files files with a linear sweep, writing the listing for path to
+// out_dir/<basename of path>.txt. Inputs are memory mapped and may be any size, and the files are
+// shared between threads worker threads. Up to 64K the listings are identical to the disassembler's
+// normal output, which stops there, while larger inputs carry on with addresses past FFFF. Returns
+// the number of files that could not be processed, all of them if two share a basename
+int batch_disassemble(char** files, int num_files, const char* out_dir, int threads);
+
+#endif
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "bench.h"
+#include "emulator.h"
+
+#define BENCH_INSTRUCTIONS 20000000L // instructions per microbenchmark run
+#define BENCH_FRAMES 600 // frames per macrobenchmark run, 10 seconds of attract mode
+#define BENCH_MAX_RUNS 100
+
+static const char* micro_names[] = {"alu", "mov", "stack", "branch", "memory"};
+
+typedef struct bench_sample { // result of one run
+	double seconds;
+	uint64_t instructions;
+	uint64_t frames;
+} bench_sample;
+
+// Returns host monotonic time in seconds
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Runs the microbenchmark block in memory. Each ROM is a straight-line sequence of the instruction
+// class being measured between an LXI SP at 0000 and a JMP back to it, so the guest loops on its
+// own and the timed loop does nothing but execute. Returns 0 if the block halts
+static int micro_run(core* cpu, bench_sample* sample) {
+	hw_state* state = core_machine(cpu);
+	double start = now();
+	for (long i = 0; i < BENCH_INSTRUCTIONS; i++) {
+		if (emulate(state) == CORE_HALTED) {
+			return 0;
+		}
+	}
+	sample->seconds = now() - start;
+	sample->instructions = state->counters.instructions;
+	return 1;
+}
+
+// Runs the game from reset for BENCH_FRAMES frames
+static int macro_run(core* cpu, bench_sample* sample) {
+	hw_state* state = core_machine(cpu);
+	double start = now();
+	for (int f = 0; f < BENCH_FRAMES; f++) {
+		run_frame(state);
+	}
+	sample->seconds = now() - start;
+	sample->instructions = state->counters.instructions;
+	sample->frames = BENCH_FRAMES;
+	return 1;
+}
+
+// Runs fn on a fresh core holding a copy of rom. The core reports a stop as a status instead of
+// ending the process, so runs share the process and its memory. Returns 1 if fn produced a sample
+static int run_once(int (*fn)(core*, bench_sample*), const byte* rom, long rom_len, byte* memory, bench_sample* sample) {
+	memset(memory, 0, MEMORY_SIZE);
+	memcpy(memory, rom, rom_len);
+	core* cpu = core_new(memory, NULL);
+	if (cpu == NULL) {
+		return 0;
+	}
+	memset(sample, 0, sizeof(*sample));
+	int ok = fn(cpu, sample);
+	core_free(cpu);
+	return ok;
+}
+
+// Benchmarks one ROM and writes its JSON result line, returns 1 on success
+static int bench_one(const char* name, const char* path, int (*fn)(core*, bench_sample*), int runs, FILE* out) {
+	byte* rom = calloc(MEMORY_SIZE, sizeof(byte));
+	long rom_len = load_rom(path, rom);
+	if (rom_len <= 0) {
+		fprintf(out, "{\"name\": \"%s\", \"status\": \"missing\", \"rom\": \"%s\"}\n", name, path);
+		free(rom);
+		return 0;
+	}
+
+	bench_sample samples[BENCH_MAX_RUNS];
+	byte* memory = malloc(MEMORY_SIZE);
+	int ok = run_once(fn, rom, rom_len, memory, &samples[0]); // warm up caches and the CPU clock
+	for (int r = 0; ok && r < runs; r++) {
+		ok = run_once(fn, rom, rom_len, memory, &samples[r]);
+	}
+	free(memory);
+	free(rom);
+	if (!ok) {
+		fprintf(out, "{\"name\": \"%s\", \"status\": \"failed\"}\n", name);
+		return 0;
+	}
+
+	double ips_sum = 0, ips_sq = 0, ns_sum = 0, ns_sq = 0, fps_sum = 0;
+	for (int r = 0; r < runs; r++) {
+		double ips = samples[r].instructions / samples[r].seconds;
+		double ns = samples[r].seconds * 1e9 / samples[r].instructions;
+		ips_sum += ips;
+		ips_sq += ips * ips;
+		ns_sum += ns;
+		ns_sq += ns * ns;
+		fps_sum += samples[r].frames / samples[r].seconds;
+	}
+	double ips_mean = ips_sum / runs;
+	double ns_mean = ns_sum / runs;
+	fprintf(out, "{\"name\": \"%s\", \"status\": \"ok\", \"runs\": %d, \"instructions\": %llu, "
+		"\"ips_mean\": %.0f, \"ips_stddev\": %.0f, \"ns_per_instruction_mean\": %.3f, \"ns_per_instruction_stddev\": %.3f",
+		name, runs, (unsigned long long) samples[0].instructions,
+		ips_mean, sqrt(fmax(ips_sq / runs - ips_mean * ips_mean, 0)),
+		ns_mean, sqrt(fmax(ns_sq / runs - ns_mean * ns_mean, 0)));
+	if (samples[0].frames) {
+		fprintf(out, ", \"frames\": %llu, \"frames_per_second_mean\": %.1f", (unsigned long long) samples[0].frames, fps_sum / runs);
+	}
+	fprintf(out, "}\n");
+	fflush(out);
+	return 1;
+}
+
+int run_benchmarks(const char* dir, const char* game_rom, int runs, FILE* out) {
+	char path[4096];
+	int failures = 0;
+	if (runs < 1) {
+		runs = 1;
+	} else if (runs > BENCH_MAX_RUNS) {
+		runs = BENCH_MAX_RUNS;
+	}
+	for (size_t i = 0; i < sizeof(micro_names) / sizeof(micro_names[0]); i++) {
+		snprintf(path, sizeof(path), "%s/%s.rom", dir, micro_names[i]);
+		failures += !bench_one(micro_names[i], path, micro_run, runs, out);
+	}
+	if (game_rom != NULL) {
+		failures += !bench_one("attract_mode", game_rom, macro_run, runs, out);
+	}
+	return failures;
+}
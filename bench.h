@@ -0,0 +1,10 @@
+#ifndef BENCH_H
+#define BENCH_H
+#include <stdio.h>
+
+// Runs the per-instruction-class microbenchmarks whose ROMs are in dir, then the attract mode
+// macrobenchmark on game_rom (skipped if NULL). Each benchmark is run once to warm up and then
+// runs times, and one JSON object per benchmark is written to out. Returns the number of failures
+int run_benchmarks(const char* dir, const char* game_rom, int runs, FILE* out);
+
+#endif
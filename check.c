@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "check.h"
+#include "emulator.h"
+#include "opcodes.h"
+#include "obs.h"
+
+#define CHECK_PC 0x0100 // where the instruction under test is placed
+#define CHECK_HL 0x2345 // address of the M operand, away from the instruction
+
+// Machine state in the form the reference model works on, registers indexed by their encoding
+typedef struct ref_state {
+	int r[8]; // B, C, D, E, H, L, M, A
+	int z, s, p, cy, ac;
+} ref_state;
+
+#define REF_H 4
+#define REF_L 5
+#define REF_M 6
+#define REF_A 7
+
+static const char ref_names[] = "BCDEHLMA";
+
+// Counts the ones bit by bit, 1 if the count is even
+static int ref_parity(int v) {
+	int count = 0;
+	for (int i = 0; i < 8; i++) {
+		count += (v >> i) & 1;
+	}
+	return count % 2 == 0;
+}
+
+static void ref_flags(ref_state* ref, int answer) {
+	ref->z = answer == 0;
+	ref->s = answer >= 0x80;
+	ref->p = ref_parity(answer);
+}
+
+// Executes opcode op on ref, written straight from the databook descriptions
+static void ref_execute(ref_state* ref, int op) {
+	int a = ref->r[REF_A];
+	int v = ref->r[op & 7];
+	int answer;
+	if (op < 0x80) { // MOV dst,src
+		ref->r[(op >> 3) & 7] = v;
+		return;
+	}
+	switch ((op >> 3) & 7) {
+		case 0: // ADD
+		case 1: { // ADC
+			int carry = ((op >> 3) & 7) == 1 ? ref->cy : 0;
+			answer = a + v + carry;
+			ref->ac = (a % 16) + (v % 16) + carry > 15;
+			ref->cy = answer > 255;
+			ref->r[REF_A] = answer % 256;
+			break;
+		}
+		case 2: // SUB
+		case 3: // SBB
+		case 7: { // CMP
+			int borrow = ((op >> 3) & 7) == 3 ? ref->cy : 0;
+			answer = a - v - borrow;
+			ref->ac = (a % 16) + (15 - v % 16) + (1 - borrow) > 15; // A plus the complement of v
+			ref->cy = answer < 0;
+			answer = (answer + 256) % 256;
+			if (((op >> 3) & 7) != 7) {
+				ref->r[REF_A] = answer;
+			}
+			break;
+		}
+		case 4: // ANA
+			answer = a & v;
+			ref->ac = ((a >> 3) & 1) || ((v >> 3) & 1);
+			ref->cy = 0;
+			ref->r[REF_A] = answer;
+			break;
+		case 5: // XRA
+			answer = a ^ v;
+			ref->ac = 0;
+			ref->cy = 0;
+			ref->r[REF_A] = answer;
+			break;
+		default: // ORA
+			answer = a | v;
+			ref->ac = 0;
+			ref->cy = 0;
+			ref->r[REF_A] = answer;
+			break;
+	}
+	ref_flags(ref, ((op >> 3) & 7) == 7 ? answer : ref->r[REF_A]);
+}
+
+// Loads ref into state, with the instruction op at CHECK_PC
+static void load_state(hw_state* state, const ref_state* ref, int op) {
+	state->b = ref->r[0];
+	state->c = ref->r[1];
+	state->d = ref->r[2];
+	state->e = ref->r[3];
+	state->h = ref->r[REF_H];
+	state->l = ref->r[REF_L];
+	state->a = ref->r[REF_A];
+	state->memory[(state->h << 8) | state->l] = ref->r[REF_M];
+	state->cc = (c_bits) {.z = ref->z, .s = ref->s, .p = ref->p, .cy = ref->cy, .ac = ref->ac};
+	state->memory[CHECK_PC] = op;
+	state->pc = CHECK_PC;
+}
+
+// Returns 1 if state matches ref and the instruction advanced the PC, with the M operand at adr
+static int matches(const hw_state* state, const ref_state* ref, int adr) {
+	return state->b == ref->r[0] && state->c == ref->r[1] && state->d == ref->r[2]
+		&& state->e == ref->r[3] && state->h == ref->r[REF_H] && state->l == ref->r[REF_L]
+		&& state->a == ref->r[REF_A] && state->memory[adr] == ref->r[REF_M]
+		&& state->cc.z == ref->z && state->cc.s == ref->s && state->cc.p == ref->p
+		&& state->cc.cy == ref->cy && state->cc.ac == ref->ac
+		&& state->pc == CHECK_PC + 1;
+}
+
+static void print_case(FILE* out, const char* label, const ref_state* ref) {
+	fprintf(out, "  %s:", label);
+	for (int i = 0; i < 8; i++) {
+		fprintf(out, " %c=%02X", ref_names[i], ref->r[i]);
+	}
+	fprintf(out, " z=%d s=%d p=%d cy=%d ac=%d\n", ref->z, ref->s, ref->p, ref->cy, ref->ac);
+}
+
+// Checks one opcode over every accumulator value, operand value and setting of the condition
+// bits, returns 1 if all of them match the reference model
+static int check_op(hw_state* state, int op, FILE* out) {
+	int src = op & 7;
+	for (int a = 0; a < 256; a++) {
+		for (int v = 0; v < 256; v++) {
+			if (src == REF_A && v > 0) {
+				break; // the operand is the accumulator
+			}
+			for (int flags = 0; flags < 2; flags++) {
+				// the other registers hold values unlike each other, HL points well away from the instruction
+				ref_state ref = {.r = {0x5a, 0xa5, 0x3c, 0xc3, CHECK_HL >> 8, CHECK_HL & 0xff, 0x69, a},
+					.z = flags, .s = flags, .p = flags, .cy = flags, .ac = flags};
+				if (src != REF_A) {
+					ref.r[src] = v;
+				}
+				int adr = (ref.r[REF_H] << 8) | ref.r[REF_L]; // where M is, even if MOV H or L moves HL
+				ref_state expected = ref;
+				ref_execute(&expected, op);
+				load_state(state, &ref, op);
+				emulate(state);
+				if (!matches(state, &expected, adr)) {
+					ref_state got = {.r = {state->b, state->c, state->d, state->e, state->h, state->l,
+						state->memory[adr], state->a}, .z = state->cc.z, .s = state->cc.s, .p = state->cc.p,
+						.cy = state->cc.cy, .ac = state->cc.ac};
+					fprintf(out, "%02X %s: mismatch\n", op, op_table[op].name);
+					print_case(out, "before  ", &ref);
+					print_case(out, "expected", &expected);
+					print_case(out, "got     ", &got);
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+int check_register_ops(FILE* out) {
+	hw_state state = {.memory = calloc(MEMORY_SIZE, sizeof(byte))};
+	int failures = 0;
+	int checked = 0;
+	for (int op = 0x40; op < 0xc0; op++) {
+		if (op_table[op].ctrl == CTRL_HALT) {
+			continue; // 0x76 is HLT, not MOV M,M
+		}
+		checked++;
+		failures += !check_op(&state, op, out);
+	}
+	fprintf(out, "%d of %d register-operand opcodes match the reference model\n", checked - failures, checked);
+	free(state.memory);
+	return failures;
+}
+
+/* ----------- OBSERVATIONS ------------- */
+
+#define CHECK_OBS_MACHINES 8
+#define CHECK_OBS_FRAMES 12
+
+// Pixel (x, y) of the upright 224x256 screen in the video RAM of memory. Screen column x is video
+// RAM row x, and screen row y is bit 255 - y of that row, counting from bit 0 of its first byte
+static int ref_pixel(const uint8_t* memory, int x, int y) {
+	int bit = 255 - y;
+	return (memory[OBS_VRAM + x * 32 + bit / 8] >> (bit % 8)) & 1;
+}
+
+// Builds one pooled 84x84 frame pixel by pixel: each output pixel is the rounded share of lit
+// pixels in its box of the screen, a pixel being lit if it is lit in either of the two frames
+static void ref_observation(const uint8_t* now, const uint8_t* prev, uint8_t* out) {
+	for (int oy = 0; oy < OBS_HEIGHT; oy++) {
+		for (int ox = 0; ox < OBS_WIDTH; ox++) {
+			int lit = 0, area = 0;
+			for (int x = ox * 224 / OBS_WIDTH; x < (ox + 1) * 224 / OBS_WIDTH; x++) {
+				for (int y = oy * 256 / OBS_HEIGHT; y < (oy + 1) * 256 / OBS_HEIGHT; y++) {
+					lit += ref_pixel(now, x, y) | ref_pixel(prev, x, y);
+					area++;
+				}
+			}
+			out[oy * OBS_WIDTH + ox] = (2 * 255 * lit + area) / (2 * area);
+		}
+	}
+}
+
+int check_observations(FILE* out) {
+	uint8_t* memories[CHECK_OBS_MACHINES];
+	uint8_t* prev = calloc(CHECK_OBS_MACHINES, MEMORY_SIZE); // video RAM each machine had a frame ago
+	uint8_t* history = calloc(CHECK_OBS_MACHINES, (size_t) CHECK_OBS_FRAMES * OBS_SIZE); // reference frames so far
+	uint8_t* batch = malloc((size_t) CHECK_OBS_MACHINES * OBS_STACK * OBS_SIZE);
+	obs_stage* stages = malloc(CHECK_OBS_MACHINES * sizeof(obs_stage));
+	int ok = prev != NULL && history != NULL && batch != NULL && stages != NULL;
+	for (int m = 0; m < CHECK_OBS_MACHINES; m++) {
+		memories[m] = calloc(MEMORY_SIZE, 1);
+		ok = ok && memories[m] != NULL;
+	}
+	if (!ok) {
+		fprintf(out, "Out of memory\n");
+	}
+	int failures = 0;
+	uint32_t seed = 0x8080;
+	for (int m = 0; ok && m < CHECK_OBS_MACHINES; m++) {
+		obs_reset(&stages[m]);
+	}
+	for (int f = 0; ok && f < CHECK_OBS_FRAMES; f++) {
+		for (int m = 0; m < CHECK_OBS_MACHINES; m++) {
+			memcpy(prev + (size_t) m * MEMORY_SIZE + OBS_VRAM, memories[m] + OBS_VRAM, OBS_VRAM_SIZE);
+			for (int i = 0; i < OBS_VRAM_SIZE; i++) { // machine m lights about m / 8 of its pixels
+				uint8_t v = 0;
+				for (int bit = 0; bit < 8; bit++) {
+					seed = seed * 1103515245 + 12345;
+					v |= ((seed >> 16) % CHECK_OBS_MACHINES < (uint32_t) m) << bit;
+				}
+				memories[m][OBS_VRAM + i] = v;
+			}
+			uint8_t* frame = history + ((size_t) m * CHECK_OBS_FRAMES + f) * OBS_SIZE;
+			ref_observation(memories[m], prev + (size_t) m * MEMORY_SIZE, frame);
+		}
+		obs_batch(stages, memories, CHECK_OBS_MACHINES, batch);
+		for (int m = 0; m < CHECK_OBS_MACHINES; m++) {
+			for (int s = 0; s < OBS_STACK; s++) { // oldest first, the first frame standing in for any before it
+				int frame = f - (OBS_STACK - 1) + s;
+				const uint8_t* want = history + ((size_t) m * CHECK_OBS_FRAMES + (frame < 0 ? 0 : frame)) * OBS_SIZE;
+				const uint8_t* got = batch + ((size_t) m * OBS_STACK + s) * OBS_SIZE;
+				int i = 0;
+				while (i < OBS_SIZE && want[i] == got[i]) {
+					i++;
+				}
+				if (i < OBS_SIZE) {
+					if (failures == 0) {
+						fprintf(out, "obs: machine %d frame %d stack %d pixel (%d, %d): expected %d, got %d\n",
+							m, f, s, i % OBS_WIDTH, i / OBS_WIDTH, want[i], got[i]);
+					}
+					failures++;
+				}
+			}
+		}
+	}
+	if (ok) {
+		fprintf(out, "%d of %d observation frames from obs_batch match the reference\n",
+			CHECK_OBS_MACHINES * CHECK_OBS_FRAMES * OBS_STACK - failures, CHECK_OBS_MACHINES * CHECK_OBS_FRAMES * OBS_STACK);
+	}
+	for (int m = 0; m < CHECK_OBS_MACHINES; m++) {
+		free(memories[m]);
+	}
+	free(prev);
+	free(history);
+	free(batch);
+	free(stages);
+	return ok ? failures : 1;
+}
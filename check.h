@@ -0,0 +1,16 @@
+#ifndef CHECK_H
+#define CHECK_H
+#include <stdio.h>
+
+// Runs every register-operand opcode (MOV r,r and ADD..CMP r) through emulate for every
+// accumulator value, operand value and carry bit, and compares the registers, memory operand,
+// condition bits and PC with a simple reference model. Prints each mismatching opcode to out
+// with the first failing case, returns the number of opcodes that failed
+int check_register_ops(FILE* out);
+
+// Runs random video RAM through obs_batch for several machines and frames and compares every
+// stacked observation with one built pixel by pixel: unpacked, turned upright and box-averaged.
+// Prints the first mismatch to out, returns the number of mismatching frames
+int check_observations(FILE* out);
+
+#endif
@@ -0,0 +1,986 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "emulator.h"
+#include "regops.h"
+#include "opcodes.h"
+#include "decode.h"
+#include "watch.h"
+#include "hle.h"
+#include "trace.h"
+#include "coverage.h"
+
+// Returns the 16 bit value stored in specified register pair
+uint16_t get_reg_pair(hw_state* state, char reg) {
+	switch(reg) {
+		case 'B': return (state->b<<8) | (state->c);
+		case 'D': return (state->d<<8) | (state->e);
+		case 'H': return (state->h<<8) | (state->l);
+		case 'S': return state->sp; // stack pointer is treated as a register pair in the manual
+		case 'P': return get_psw(state);
+		default: abort(); // the opcode handlers only pass the pairs above
+	}
+}
+
+// Sets the 16bit value stored in specified register pair to v
+void set_reg_pair(hw_state* state, uint16_t v, char reg) {
+	switch(reg) {
+		case 'B': state->b = (v>>8) & 0xff; state->c = v & 0xff; break;
+		case 'D': state->d = (v>>8) & 0xff; state->e = v & 0xff; break;
+		case 'H': state->h = (v>>8) & 0xff; state->l = v & 0xff; break;
+		case 'S': state->sp = v; break; // stack pointer is treated as a register pair in the manual
+		case 'P': set_psw(state, v); break;
+	}
+}
+
+// Gets accumulator concatenated with the condition bits as described in databook (what PUSH PSW stores)
+// PSW is stored like: |_ _ _ _A_ _ _ _|s_z_0_ac_0_p_1_cy|
+uint16_t get_psw(hw_state* state) {
+	uint8_t flags = (state->cc.s << 7) | (state->cc.z << 6) | (state->cc.ac << 4) | (state->cc.p << 2) | 0x02 | state->cc.cy;
+	return (state->a << 8) | flags;
+}
+
+// Sets machine state from PSW value as described in databook
+// PSW is stored like: |_ _ _ _A_ _ _ _|s_z_0_ac_0_p_1_cy|
+void set_psw(hw_state* state, uint16_t psw) {
+	state->a = psw >> 8; // 8 most significant bits of psw
+	state->cc.s = (psw >> 7) & 1;
+	state->cc.z = (psw >> 6) & 1;
+	state->cc.ac = (psw >> 4) & 1;
+	state->cc.p = (psw >> 2) & 1;
+	state->cc.cy = psw & 1;
+}
+
+// Returns the specified register
+uint8_t get_reg(hw_state* state, char reg) {
+	switch(reg) {
+		case 'B': return state->b;
+		case 'C': return state->c;
+		case 'D': return state->d;
+		case 'E': return state->e;
+		case 'H': return state->h;
+		case 'L': return state->l;
+		case 'M': return mem_read(state, get_reg_pair(state,'H'));
+		case 'A': return state->a;
+		default: abort(); // the opcode handlers only pass the registers above
+	}
+}
+
+// Sets the specified regist to value v
+void set_reg(hw_state* state, uint8_t v, char reg) {
+	switch(reg) {
+		case 'B': state->b = v; break;
+		case 'C': state->c = v; break;
+		case 'D': state->d = v; break;
+		case 'E': state->e = v; break;
+		case 'H': state->h = v; break;
+		case 'L': state->l = v; break;
+		case 'M': mem_write(state, get_reg_pair(state,'H'), v); break;
+		case 'A': state->a = v; break;
+	}
+}
+
+// Load 16-bit immediate into register pair
+void lxi(hw_state* state, byte* opcode, char reg) {
+	switch (reg) {
+		case 'B': state->b = opcode[2]; state->c = opcode[1]; break;
+		case 'D': state->d = opcode[2]; state->e = opcode[1]; break;
+		case 'H': state->h = opcode[2]; state->l = opcode[1]; break;
+		case 'S': state->sp = (opcode[2] << 8) | opcode[1]; break;
+	}
+}
+
+// Exchange H and L with D and E
+void xchg(hw_state* state) {
+	uint16_t de = get_reg_pair(state, 'D');
+	set_reg_pair(state, get_reg_pair(state, 'H'), 'D');
+	set_reg_pair(state, de, 'H');
+}
+
+// Store L at the address following the opcode and H at the next address
+void shld(hw_state* state, byte* opcode) {
+	uint16_t adr = (opcode[2] << 8) | opcode[1];
+	mem_write(state, adr, state->l);
+	mem_write(state, adr+1, state->h);
+}
+
+// Load L from the address following the opcode and H from the next address
+void lhld(hw_state* state, byte* opcode) {
+	uint16_t adr = (opcode[2] << 8) | opcode[1];
+	state->l = mem_read(state, adr);
+	state->h = mem_read(state, adr+1);
+}
+
+/* -------------- STACK ---------------- */
+
+// pop stack to specified register
+void pop(hw_state * state, char reg) {
+	set_reg_pair(state, pop_16(state), reg); // TODO: inefficient 8b->16b->8b
+}
+
+void push(hw_state* state, uint16_t v) {
+	uint8_t v_h = (v >> 8) & 0xff; // high byte of v
+	uint8_t v_l = v & 0xff; // low byte of v
+	mem_write(state, state->sp-1, v_h); // push high byte first, below the current top
+	mem_write(state, state->sp-2, v_l); // push low byte last, so pop_16 reads it back little endian
+	state->sp -= 2; // point stack pointer at top of stack
+}
+
+uint16_t pop_16(hw_state* state) {
+	uint16_t v = (mem_read(state, state->sp+1) << 8) | mem_read(state, state->sp);
+	state->sp += 2; // point stack pointer at top of stack
+	return v;
+}
+
+void sphl(hw_state* state) {
+	state->sp = get_reg_pair(state,'H');
+}
+
+// Exchange H and L with the word at the top of the stack
+void xthl(hw_state* state) {
+	uint8_t l = mem_read(state, state->sp);
+	uint8_t h = mem_read(state, state->sp+1);
+	mem_write(state, state->sp, state->l);
+	mem_write(state, state->sp+1, state->h);
+	state->h = h;
+	state->l = l;
+}
+
+/* --------------- JUMPS  ----------------*/
+
+// Jump to address contained in the two bytes following the opcode
+void jmp(hw_state* state, byte* opcode) {
+	state->pc = (opcode[2] << 8) | opcode[1]; // jump
+}
+
+// Jump to address contained in HL register pair
+void pchl(hw_state* state) {
+	state->pc = get_reg_pair(state, 'H');
+}
+
+// Jump if condition is met
+void jump_if(hw_state* state, byte* opcode, int cond) {
+	if (cond) {
+		state->pc = (opcode[2] << 8) | opcode[1];
+	}
+}
+
+// Jump if zero bit is set
+void jz(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, state->cc.z);
+}
+
+// Jump if zero bit is not set
+void jnz(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, !(state->cc.z));
+}
+
+// Jump if carry bit is set
+void jc(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, state->cc.cy);
+}
+
+// Jump if carry bit is not set
+void jnc(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, !(state->cc.cy));
+}
+
+// Jump if parity odd
+void jpo(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, !(state->cc.p));
+}
+
+// Jump if parity even
+void jpe(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, state->cc.p);
+}
+
+// Jump if sign minus
+void jm(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, state->cc.s);
+}
+
+// Jump if sign plus
+void jp(hw_state* state, byte* opcode) {
+	jump_if(state, opcode, !(state->cc.s));
+}
+
+// Returns whether the condition of a conditional jump, call or return holds, from bits 3-5 of its opcode
+int condition(hw_state* state, uint8_t op) {
+	switch ((op >> 3) & 7) {
+		case 0: return !state->cc.z; // NZ
+		case 1: return state->cc.z; // Z
+		case 2: return !state->cc.cy; // NC
+		case 3: return state->cc.cy; // C
+		case 4: return !state->cc.p; // PO
+		case 5: return state->cc.p; // PE
+		case 6: return !state->cc.s; // P
+		default: return state->cc.s; // M
+	}
+}
+
+/* ----------- CALL STACK ------------- */
+
+// Records the return address just pushed by a CALL, RST or interrupt on the shadow call stack
+static inline void enter_call(hw_state* state, uint16_t return_adr) {
+	if (state->call_depth == CALL_STACK_DEPTH) { // too deep, forget the outermost call
+		memmove(state->call_stack, state->call_stack + 1, (CALL_STACK_DEPTH - 1) * sizeof(uint16_t));
+		memmove(state->call_sp, state->call_sp + 1, (CALL_STACK_DEPTH - 1) * sizeof(uint16_t));
+		state->call_depth--;
+	}
+	state->call_stack[state->call_depth] = return_adr;
+	state->call_sp[state->call_depth] = state->sp;
+	state->call_depth++;
+}
+
+/* ----------- RETURNS ------------- */
+
+// Pops return address from stack, along with every shadow call stack entry whose return address
+// is no longer on the stack
+void ret(hw_state* state) {
+	state->pc = pop_16(state);
+	while (state->call_depth > 0 && state->call_sp[state->call_depth-1] < state->sp) {
+		state->call_depth--;
+	}
+}
+
+// Return if condition is met
+void ret_if(hw_state* state, int cond) {
+	if (cond) {
+		ret(state);
+		state->cycles += op_table[0xc0].cycles_taken - op_table[0xc0].cycles; // taken returns are slower, all take the same time
+	}
+}
+
+// Return if zero bit is set
+void rz(hw_state* state) {
+	ret_if(state, state->cc.z);
+}
+
+// Return if zero bit is not set
+void rnz(hw_state* state) {
+	ret_if(state, !(state->cc.z));
+}
+
+// Return if carry bit is set
+void rc(hw_state* state) {
+	ret_if(state, state->cc.cy);
+}
+
+// Return if carry bit is set
+void rnc(hw_state* state) {
+	ret_if(state, !(state->cc.cy));
+}
+
+// Return if parity is even
+void rpe(hw_state* state) {
+	ret_if(state, state->cc.p);
+}
+
+// Return if parity is odd
+void rpo(hw_state* state) {
+	ret_if(state, !(state->cc.p));
+}
+
+// Return if sign is negative
+void rm(hw_state* state) {
+	ret_if(state, state->cc.s);
+}
+
+// Return if sign is positive
+void rp(hw_state* state) {
+	ret_if(state, !(state->cc.s));
+}
+
+/* -------------- CALLS --------------- */
+
+// Push pc to stack then jump to address specified in two bytes following opcode
+void call(hw_state* state, byte* opcode) {
+	push(state, state->pc); // push address of next instruction to stack
+	enter_call(state, state->pc);
+	jmp(state, opcode);
+	if (state->hle != NULL && hle_is_hooked(state->hle, state->pc)) {
+		hle_call(state); // runs a native version of the subroutine, including its return
+	}
+}
+
+// Reset - make call to specified address
+void rst(hw_state* state, uint16_t adr) {
+	push(state, state->pc);
+	enter_call(state, state->pc);
+	state->pc = adr;
+}
+
+void call_if(hw_state* state, byte* opcode, int cond) {
+	if (cond) {
+		call(state, opcode);
+		state->cycles += op_table[*opcode].cycles_taken - op_table[*opcode].cycles; // taken calls are slower
+	}
+}
+
+// Call if zero bit is set
+void cz(hw_state* state, byte* opcode) {
+	call_if(state, opcode, state->cc.z);
+}
+
+// Call if zero bit is not set
+void cnz(hw_state* state, byte* opcode) {
+	call_if(state, opcode, !(state->cc.z));
+}
+
+// Call if carry bit is set
+void cc(hw_state* state, byte* opcode) {
+	call_if(state, opcode, state->cc.cy);
+}
+
+// Call if carry bit is not set
+void cnc(hw_state* state, byte* opcode) {
+	call_if(state, opcode, !(state->cc.cy));
+}
+
+// Call if parity odd
+void cpo(hw_state* state, byte* opcode) {
+	call_if(state, opcode, !(state->cc.p));
+}
+
+// Call if parity even
+void cpe(hw_state* state, byte* opcode) {
+	call_if(state, opcode, state->cc.p);
+}
+
+// Call if sign minus
+void cm(hw_state* state, byte* opcode) {
+	call_if(state, opcode, state->cc.s);
+}
+
+// Call if sign plus
+void cp(hw_state* state, byte* opcode) {
+	call_if(state, opcode, !(state->cc.s));
+}
+
+/* ----------- ARITHMETIC ------------- */
+
+// Increment register pair by 1
+void inx(hw_state* state, char reg) {
+	uint16_t v = get_reg_pair(state, reg);
+	v += 1;
+	set_reg_pair(state, v, reg);
+}
+
+// Decrement register pair by 1
+void dcx(hw_state* state, char reg) {
+	uint16_t v = get_reg_pair(state,reg);
+	v += ~1 + 1; // -1 in TC TODO: is this necessary?
+	set_reg_pair(state, v, reg);
+}
+
+// Increment register by 1, does not affect carry
+void inr(hw_state* state, char reg) {
+	uint8_t v = get_reg(state,reg);
+	uint8_t answer = v + 1;
+	state->cc.ac = (answer & 0x0f) == 0; // carry out of bit 3
+	set_zsp(state, answer);
+	set_reg(state,answer,reg);
+}
+
+// Decrement register by 1, does not affect carry
+void dcr(hw_state* state, char reg) {
+	uint8_t v = get_reg(state,reg);
+	uint8_t answer = v - 1;
+	state->cc.ac = (v & 0x0f) != 0; // the 8080 adds 0xff, which carries out of bit 3 unless the low digit is 0
+	set_zsp(state, answer);
+	set_reg(state,answer,reg);
+}
+
+// Adds the contents of register pair reg to HL register pair
+void dad(hw_state* state, char reg) {
+	uint32_t v = (uint32_t) get_reg_pair(state,reg); // get 16 bit value
+	uint32_t answer = v + get_reg_pair(state,'H'); // add to contents of HL
+	state->cc.cy = answer > 0xffff; // update (16 bit) carry
+	set_reg_pair(state,answer & 0xffff,'H'); // store (16 bit) answer in HL pair
+}
+
+// Decimal adjust accumulator: adds 6 to each BCD digit that is over 9 or carried out of
+void daa(hw_state* state) {
+	uint8_t correction = 0;
+	uint8_t carry = state->cc.cy;
+	if ((state->a & 0x0f) > 9 || state->cc.ac) {
+		correction |= 0x06;
+	}
+	if (state->a > 0x99 || state->cc.cy) {
+		correction |= 0x60;
+		carry = 1;
+	}
+	alu_add(state, correction, 0); // sets the auxiliary carry from the low digit
+	state->cc.cy = carry;
+}
+
+/* -------------- LOGICAL --------------- */
+// Perform bitwise NOT on accumulator
+void cma(hw_state* state) {
+	state->a = ~state->a;
+}
+
+// Rotate accumulator left
+void rlc(hw_state* state) {
+	state->cc.cy = state->a >> 7; // set carry to high order bit of accumulator
+	state->a = (state->a << 1) | state->cc.cy; // wrap around high order bit
+}
+
+// Rotate accumulator right
+void rrc(hw_state* state) {
+	state->cc.cy = (state->a & 0x01); // set carry to low order bit of accumulator
+	state->a = (state->a >> 1) | (state->cc.cy << 7); // wrap around low order bit
+}
+
+// Rotate accumulator left through carry
+void ral(hw_state* state) {
+	uint8_t cy_old = state->cc.cy;
+	state->cc.cy = state->a >> 7; // set carry to high order bit of accumulator
+	state->a = (state->a << 1) | cy_old; // wrap around old carry
+}
+
+// Rotate accumulator right through carry
+void rar(hw_state* state) {
+	uint8_t cy_old = state->cc.cy;
+	state->cc.cy = (state->a & 0x01); // set carry to low order bit of accumulator
+	state->a = (state->a >> 1) | (cy_old << 7); // wrap around old carry
+}
+
+// Complement carry bit
+void cmc(hw_state* state) {
+	state->cc.cy = !state->cc.cy;
+}
+
+// Set carry bit
+void stc(hw_state* state) {
+	state->cc.cy = 1;
+}
+
+/* ------------- MEMORY --------------- */
+
+// Accesses to pages with a slow_pages bit set come here, e.g. watched pages, pages mapped to the
+// host or any page while a trace is being recorded
+uint8_t mem_read_slow(hw_state* state, uint16_t adr) {
+	uint8_t v = state->memory[adr];
+	if (state->slow_pages[adr >> 8] & PAGE_IO) {
+		v = state->io.read != NULL ? state->io.read(state->io.user, adr) : 0xff; // nothing drives the bus
+	}
+	if ((state->slow_pages[adr >> 8] & PAGE_WATCH) && state->watch != NULL) {
+		watch_access(state, adr, WATCH_READ, v, v);
+	}
+	return v;
+}
+
+void mem_write_slow(hw_state* state, uint16_t adr, uint8_t v) {
+	uint8_t old = state->memory[adr];
+	if (state->slow_pages[adr >> 8] & PAGE_IO) {
+		if (state->io.write != NULL) {
+			state->io.write(state->io.user, adr, v);
+		}
+	} else {
+		state->memory[adr] = v;
+	}
+	if ((state->slow_pages[adr >> 8] & PAGE_WATCH) && state->watch != NULL) {
+		watch_access(state, adr, WATCH_WRITE, old, v);
+	}
+	if (state->recorder != NULL) {
+		trace_write(state->recorder, adr, v);
+	}
+}
+
+/* --------------- PORTS --------------- */
+
+// Reads port into the accumulator, which keeps its value when the host has nothing on the ports
+void in(hw_state* state, uint8_t port) {
+	if (state->io.in != NULL) {
+		state->a = state->io.in(state->io.user, port);
+	}
+	state->counters.port_reads++;
+}
+
+// Writes the accumulator to port
+void out(hw_state* state, uint8_t port) {
+	if (state->io.out != NULL) {
+		state->io.out(state->io.user, port, state->a);
+	}
+	state->counters.port_writes++;
+}
+
+/* ----------- INTERRUPTS -------------- */
+
+void ei(hw_state* state) {
+	state->interrupt_enabled = 1;
+}
+
+void di(hw_state* state) {
+	state->interrupt_enabled = 0;
+}
+
+void generate_interrupt(hw_state* state, int n) {
+	if (!state->interrupt_enabled) {
+		return;
+	}
+	push(state, state->pc); // after a HLT this is the instruction following it
+	enter_call(state, state->pc);
+	state->pc = n << 3; // same target as RST n
+	state->interrupt_enabled = 0;
+	state->halted = 0;
+	state->counters.interrupts++;
+}
+
+// Marks the instruction about to execute and, for a conditional, the way it is about to go
+static inline void cover(coverage_map* map, hw_state* state, const op_info* info) {
+	uint16_t pc = state->pc;
+	map->executed[pc >> 6] |= 1ULL << (pc & 63);
+	if (info->ctrl == CTRL_BRANCH || info->ctrl == CTRL_CALL_IF || info->ctrl == CTRL_RET_IF) {
+		uint32_t edge = (pc << 1) | condition(state, state->memory[pc]);
+		map->edges[edge >> 6] |= 1ULL << (edge & 63);
+	}
+}
+
+// Executes next instruction for processor in state hw_state
+core_status emulate(hw_state* state) {
+	if (state->halted) {
+		return CORE_HALTED;
+	}
+	// the instruction's bytes, copied so an instruction at the top of memory wraps around like the PC does
+	byte opcode[3] = {state->memory[state->pc], state->memory[(uint16_t) (state->pc+1)], state->memory[(uint16_t) (state->pc+2)]};
+	state->op_pc = state->pc;
+	const op_info* info = &op_table[*opcode];
+	if (state->trace != NULL) { // print the instruction being executed
+		char text[32];
+		format_op(text, sizeof(text), state->memory, state->pc);
+		fprintf(state->trace, "%s\n", text);
+	}
+	if (state->coverage != NULL) {
+		cover(state->coverage, state, info);
+	}
+	state->pc += info->size; // fetched, jumps and calls overwrite pc and push this return address
+	state->cycles += info->cycles;
+    // Each "register pair" is denoted by the first register. E.g. 'B' can refer to the pair B, C
+	switch (*opcode) {
+		case 0x00: break; // NOP - Do nothing
+		case 0x01: lxi(state, opcode, 'B'); break; // LXI B - Load 16-bit immediate into register pair
+		case 0x02: mem_write(state, get_reg_pair(state,'B'), state->a); break; // STAX B - Store accumulator
+		case 0x03: inx(state,'B'); break; // INX B - Increment 16-bit value in register pair
+		case 0x04: inr(state,'B'); break; // INR B - Increment register
+		case 0x05: dcr(state,'B'); break; // DCR B - Decrement register
+		case 0x06: set_reg(state, opcode[1], 'B'); break; // MVI B - Load immediate into register
+		case 0x07: rlc(state); break; // RLC - Rotate accumulator left
+		case 0x08: break; // NOP
+		case 0x09: dad(state,'B'); break; // DAD B - Add register pair to H and L registers
+		case 0x0a: state->a = mem_read(state, get_reg_pair(state,'B')); break; // LDAX B - Load accumulator from register pair
+		case 0x0b: dcx(state,'B'); break; // DCX B - Decrement 16-bit value in register pair
+		case 0x0c: inr(state,'C'); break; // INR C
+		case 0x0d: dcr(state,'C'); break; // DCR C
+		case 0x0e: set_reg(state, opcode[1], 'C'); break; // MVI C
+		case 0x0f: rrc(state); break; // RRC - Rotate accumulator right
+		case 0x10: break; // NOP
+		case 0x11: lxi(state, opcode, 'D'); break; // LXI D
+		case 0x12: mem_write(state, get_reg_pair(state,'D'), state->a); break; // STAX D
+		case 0x13: inx(state,'D'); break; // INX D
+		case 0x14: inr(state,'D'); break; // INR D
+		case 0x15: dcr(state,'D'); break; // DCR D
+		case 0x16: set_reg(state, opcode[1], 'D'); break; // MVI D
+		case 0x17: ral(state); break; // RAL - Rotate accumulator left through carry
+		case 0x18: break; // NOP
+		case 0x19: dad(state,'D'); break; // DAD D
+		case 0x1a: state->a = mem_read(state, get_reg_pair(state,'D')); break; // LDAX D
+		case 0x1b: dcx(state,'D'); break; // DCX D
+		case 0x1c: inr(state,'E'); break; // INR E
+		case 0x1d: dcr(state,'E'); break; // DCR E
+		case 0x1e: set_reg(state, opcode[1], 'E'); break; // MVI E
+		case 0x1f: rar(state); break; // RAR - Rotate accumulator right through carry
+		case 0x20: break; // NOP
+		case 0x21: lxi(state,opcode,'H'); break; // LXI H
+		case 0x22: shld(state, opcode); break; // SHLD - Contents of H and L stored at address
+		case 0x23: inx(state,'H'); break; // INX H
+		case 0x24: inr(state,'H'); break; // INR H
+		case 0x25: dcr(state,'H'); break; // DCR H
+		case 0x26: set_reg(state, opcode[1], 'H'); break; // MVI H
+		case 0x27: daa(state); break; // DAA - Adjust 8 bit accumulator to form two four bit decimals
+		case 0x28: break; // NOP
+		case 0x29: dad(state,'H'); break; // DAD H
+		case 0x2a: lhld(state, opcode); break; // LHLD - Load H and L with contents stored at address
+		case 0x2b: dcx(state,'H'); break; // DCX H
+		case 0x2c: inr(state,'L'); break; // INR L
+		case 0x2d: dcr(state,'L'); break; // DCR L
+		case 0x2e: set_reg(state, opcode[1], 'L'); break; // MVI L
+		case 0x2f: cma(state); break; // CMA - Complement accumulator
+		case 0x30: break; // NOP
+		case 0x31: lxi(state,opcode,'S'); break; // LXI SP
+		case 0x32: mem_write(state, (opcode[2] << 8) | opcode[1], state->a); break; // STA - Store data in accumulator at address
+		case 0x33: inx(state,'S'); break; // INX SP
+		case 0x34: inr(state,'M'); break; // INR M
+		case 0x35: dcr(state,'M'); break; // DCR M
+		case 0x36: set_reg(state, opcode[1], 'M'); break; // MVI M
+		case 0x37: stc(state); break; // STC
+		case 0x38: break; // NOP
+		case 0x39: dad(state,'S'); break; // DAD SP
+		case 0x3a: state->a = mem_read(state, (opcode[2] << 8) | opcode[1]); break; // LDA - Load accumulator from address
+		case 0x3b: dcx(state,'S'); break; // DCX SP
+		case 0x3c: inr(state,'A'); break; // INR A
+		case 0x3d: dcr(state,'A'); break; // DCR A
+		case 0x3e: set_reg(state, opcode[1], 'A'); break; // MVI A
+		case 0x3f: cmc(state); break; // CMC
+		case 0x40: mov_B_B(state); break; // MOV B,B
+		case 0x41: mov_B_C(state); break; // MOV B,C
+		case 0x42: mov_B_D(state); break; // MOV B,D
+		case 0x43: mov_B_E(state); break; // MOV B,E
+		case 0x44: mov_B_H(state); break; // MOV B,H
+		case 0x45: mov_B_L(state); break; // MOV B,L
+		case 0x46: mov_B_M(state); break; // MOV B,M
+		case 0x47: mov_B_A(state); break; // MOV B,A
+		case 0x48: mov_C_B(state); break; // MOV C,B
+		case 0x49: mov_C_C(state); break; // MOV C,C
+		case 0x4a: mov_C_D(state); break; // MOV C,D
+		case 0x4b: mov_C_E(state); break; // MOV C,E
+		case 0x4c: mov_C_H(state); break; // MOV C,H
+		case 0x4d: mov_C_L(state); break; // MOV C,L
+		case 0x4e: mov_C_M(state); break; // MOV C,M
+		case 0x4f: mov_C_A(state); break; // MOV C,A
+		case 0x50: mov_D_B(state); break; // MOV D,B
+		case 0x51: mov_D_C(state); break; // MOV D,C
+		case 0x52: mov_D_D(state); break; // MOV D,D
+		case 0x53: mov_D_E(state); break; // MOV D,E
+		case 0x54: mov_D_H(state); break; // MOV D,H
+		case 0x55: mov_D_L(state); break; // MOV D,L
+		case 0x56: mov_D_M(state); break; // MOV D,M
+		case 0x57: mov_D_A(state); break; // MOV D,A
+		case 0x58: mov_E_B(state); break; // MOV E,B
+		case 0x59: mov_E_C(state); break; // MOV E,C
+		case 0x5a: mov_E_D(state); break; // MOV E,D
+		case 0x5b: mov_E_E(state); break; // MOV E,E
+		case 0x5c: mov_E_H(state); break; // MOV E,H
+		case 0x5d: mov_E_L(state); break; // MOV E,L
+		case 0x5e: mov_E_M(state); break; // MOV E,M
+		case 0x5f: mov_E_A(state); break; // MOV E,A
+		case 0x60: mov_H_B(state); break; // MOV H,B
+		case 0x61: mov_H_C(state); break; // MOV H,C
+		case 0x62: mov_H_D(state); break; // MOV H,D
+		case 0x63: mov_H_E(state); break; // MOV H,E
+		case 0x64: mov_H_H(state); break; // MOV H,H
+		case 0x65: mov_H_L(state); break; // MOV H,L
+		case 0x66: mov_H_M(state); break; // MOV H,M
+		case 0x67: mov_H_A(state); break; // MOV H,A
+		case 0x68: mov_L_B(state); break; // MOV L,B
+		case 0x69: mov_L_C(state); break; // MOV L,C
+		case 0x6a: mov_L_D(state); break; // MOV L,D
+		case 0x6b: mov_L_E(state); break; // MOV L,E
+		case 0x6c: mov_L_H(state); break; // MOV L,H
+		case 0x6d: mov_L_L(state); break; // MOV L,L
+		case 0x6e: mov_L_M(state); break; // MOV L,M
+		case 0x6f: mov_L_A(state); break; // MOV L,A
+		case 0x70: mov_M_B(state); break; // MOV M,B
+		case 0x71: mov_M_C(state); break; // MOV M,C
+		case 0x72: mov_M_D(state); break; // MOV M,D
+		case 0x73: mov_M_E(state); break; // MOV M,E
+		case 0x74: mov_M_H(state); break; // MOV M,H
+		case 0x75: mov_M_L(state); break; // MOV M,L
+		case 0x76: state->halted = 1; break; // HLT - Stop until an interrupt
+		case 0x77: mov_M_A(state); break; // MOV M,A
+		case 0x78: mov_A_B(state); break; // MOV A,B
+		case 0x79: mov_A_C(state); break; // MOV A,C
+		case 0x7a: mov_A_D(state); break; // MOV A,D
+		case 0x7b: mov_A_E(state); break; // MOV A,E
+		case 0x7c: mov_A_H(state); break; // MOV A,H
+		case 0x7d: mov_A_L(state); break; // MOV A,L
+		case 0x7e: mov_A_M(state); break; // MOV A,M
+		case 0x7f: mov_A_A(state); break; // MOV A,A
+		case 0x80: add_B(state); break; // ADD B
+		case 0x81: add_C(state); break; // ADD C
+		case 0x82: add_D(state); break; // ADD D
+		case 0x83: add_E(state); break; // ADD E
+		case 0x84: add_H(state); break; // ADD H
+		case 0x85: add_L(state); break; // ADD L
+		case 0x86: add_M(state); break; // ADD M
+		case 0x87: add_A(state); break; // ADD A
+		case 0x88: adc_B(state); break; // ADC B
+		case 0x89: adc_C(state); break; // ADC C
+		case 0x8a: adc_D(state); break; // ADC D
+		case 0x8b: adc_E(state); break; // ADC E
+		case 0x8c: adc_H(state); break; // ADC H
+		case 0x8d: adc_L(state); break; // ADC L
+		case 0x8e: adc_M(state); break; // ADC M
+		case 0x8f: adc_A(state); break; // ADC A
+		case 0x90: sub_B(state); break; // SUB B - Subtract register from accumulator
+		case 0x91: sub_C(state); break; // SUB C
+		case 0x92: sub_D(state); break; // SUB D
+		case 0x93: sub_E(state); break; // SUB E
+		case 0x94: sub_H(state); break; // SUB H
+		case 0x95: sub_L(state); break; // SUB L
+		case 0x96: sub_M(state); break; // SUB M
+		case 0x97: sub_A(state); break; // SUB A
+		case 0x98: sbb_B(state); break; // SBB B - Subtract register from accumulator with borrow
+		case 0x99: sbb_C(state); break; // SBB C
+		case 0x9a: sbb_D(state); break; // SBB D
+		case 0x9b: sbb_E(state); break; // SBB E
+		case 0x9c: sbb_H(state); break; // SBB H
+		case 0x9d: sbb_L(state); break; // SBB L
+		case 0x9e: sbb_M(state); break; // SBB M
+		case 0x9f: sbb_A(state); break; // SBB A
+		case 0xa0: ana_B(state); break; // ANA B - Bitwise AND register with accumulator
+		case 0xa1: ana_C(state); break; // ANA C
+		case 0xa2: ana_D(state); break; // ANA D
+		case 0xa3: ana_E(state); break; // ANA E
+		case 0xa4: ana_H(state); break; // ANA H
+		case 0xa5: ana_L(state); break; // ANA L
+		case 0xa6: ana_M(state); break; // ANA M
+		case 0xa7: ana_A(state); break; // ANA A
+		case 0xa8: xra_B(state); break; // XRA B - Bitwise XOR register with accumulator
+		case 0xa9: xra_C(state); break; // XRA C
+		case 0xaa: xra_D(state); break; // XRA D
+		case 0xab: xra_E(state); break; // XRA E
+		case 0xac: xra_H(state); break; // XRA H
+		case 0xad: xra_L(state); break; // XRA L
+		case 0xae: xra_M(state); break; // XRA M
+		case 0xaf: xra_A(state); break; // XRA A
+		case 0xb0: ora_B(state); break; // ORA B - Bitwise OR register with accumulator
+		case 0xb1: ora_C(state); break; // ORA C
+		case 0xb2: ora_D(state); break; // ORA D
+		case 0xb3: ora_E(state); break; // ORA E
+		case 0xb4: ora_H(state); break; // ORA H
+		case 0xb5: ora_L(state); break; // ORA L
+		case 0xb6: ora_M(state); break; // ORA M
+		case 0xb7: ora_A(state); break; // ORA A
+		case 0xb8: cmp_B(state); break; // CMP B - Set conditon bits based on register less than accumulator
+		case 0xb9: cmp_C(state); break; // CMP C
+		case 0xba: cmp_D(state); break; // CMP D
+		case 0xbb: cmp_E(state); break; // CMP E
+		case 0xbc: cmp_H(state); break; // CMP H
+		case 0xbd: cmp_L(state); break; // CMP L
+		case 0xbe: cmp_M(state); break; // CMP M
+		case 0xbf: cmp_A(state); break; // CMP A
+		case 0xc0: rnz(state); break; // RNZ - If zero bit is zero, jump to return address
+		case 0xc1: pop(state,'B'); break; // POP B - Pop stack to register pair
+		case 0xc2: jnz(state, opcode); break; // JNZ - If zero bit is zero, jump to address
+		case 0xc3: jmp(state, opcode); break; // JMP - Jump to address
+		case 0xc4: cnz(state, opcode); break; // CNZ - If zero bit is zero, call address
+		case 0xc5: push(state, get_reg_pair(state,'B')); break; // PUSH B - Push register pair onto stack
+		case 0xc6: alu_add(state, opcode[1], 0); break; // ADI - Add immediate to accumulator
+		case 0xc7: rst(state, 0<<3); break; // RST 0
+		case 0xc8: rz(state); break; // RZ - If zero bit is one, return
+		case 0xc9: ret(state); break; // RET - Return to address at top of stack
+		case 0xca: jz(state, opcode); break; // JZ - If zero bit is one, jump to address
+		case 0xcb: break; // NOP
+		case 0xcc: cz(state, opcode); break; // CZ - If zero bit is one, call address
+		case 0xcd: call(state, opcode); break; // CALL - Push PC to stack, jump to address
+		case 0xce: alu_add(state, opcode[1], state->cc.cy); break; // ACI - Add immediate to accumulator with carry
+		case 0xcf: rst(state, 1<<3); break; // RST 1 - Special call
+		case 0xd0: rnc(state); break; // RNC - If not carry, return
+		case 0xd1: pop(state,'D'); break; // POP D
+		case 0xd2: jnc(state, opcode); break; // JNC - If not carry, jump to address
+		case 0xd3: out(state, opcode[1]); break; // OUT - Write accumulator to port
+		case 0xd4: cnc(state, opcode); break; // CNC - If not carry, call address
+		case 0xd5: push(state, get_reg_pair(state,'D')); break; // PUSH D
+		case 0xd6: state->a = alu_sub(state, opcode[1], 0); break; // SUI - Subtract immediate from accumulator
+		case 0xd7: rst(state, 2<<3); break; // RST 2
+		case 0xd8: rc(state); break; // RC - If carry, return
+		case 0xd9: break; // NOP
+		case 0xda: jc(state, opcode); break; // JC - If carry, jump to address
+		case 0xdb: in(state, opcode[1]); break; // IN - Read port into accumulator
+		case 0xdc: cc(state, opcode); break; // CC - If carry, call address
+		case 0xdd: break; // NOP
+		case 0xde: state->a = alu_sub(state, opcode[1], state->cc.cy); break; // SBI - Subtract immediate from accumulator with carry
+		case 0xdf: rst(state, 3<<3); break; // RST 3
+		case 0xe0: rpo(state); break; // RPO - If parity bit zero, return
+		case 0xe1: pop(state,'H'); break; // POP H
+		case 0xe2: jpo(state, opcode); break; // JPO - If parity bit zero, jump to address
+		case 0xe3: xthl(state); break; // XTHL - Exchange H and L registers with data at stack pointer
+		case 0xe4: cpo(state, opcode); break; // CPO - If PO, call address
+		case 0xe5: push(state, get_reg_pair(state,'H')); break; // PUSH H
+		case 0xe6: alu_and(state, opcode[1]); break; // ANI - Bitwise AND immediate with accumulator
+		case 0xe7: rst(state, 4<<3); break; // RST 4
+		case 0xe8: rpe(state); break; // RPE
+		case 0xe9: pchl(state); break; // PCHL - PC set to H and L
+		case 0xea: jpe(state, opcode); break; // JPE - If parity bit one, jump to address
+		case 0xeb: xchg(state); break; // XCHG - Exchange H and L registers with D and E registers
+		case 0xec: cpe(state, opcode); break; // CPE - If parity bit one, call address
+		case 0xed: break; // NOP
+		case 0xee: alu_xor(state, opcode[1]); break; // XRI - Bitwise XOR immediate with accumulator
+		case 0xef: rst(state, 5<<3); break; // RST 5
+		case 0xf0: rp(state); break; // RP - If sign bit zero, return
+		case 0xf1: pop(state,'P'); break; // POP PSW
+		case 0xf2: jp(state, opcode); break; // JP - If sign bit zero, jump to address
+		case 0xf3: di(state); break; // DI
+		case 0xf4: cp(state, opcode); break; // CP - If sign bit zero, call address
+		case 0xf5: push(state, get_psw(state)); break; // PUSH PSW
+		case 0xf6: alu_or(state, opcode[1]); break; // ORI - Bitwise OR immediate with accumulator
+		case 0xf7: rst(state, 6<<3); break; // RST 6
+		case 0xf8: rm(state); break; // RM - If sign bit one, return
+		case 0xf9: sphl(state); break; // SPHL - H and L replace the stack pointer
+		case 0xfa: jm(state, opcode); break; // JM - If sign bit one, jump to address
+		case 0xfb: ei(state); break; // EI
+		case 0xfc: cm(state, opcode); break; // CM - If sign bit one, call address
+		case 0xfd: break; // NOP
+		case 0xfe: alu_sub(state, opcode[1], 0); break; // CPI - Compare immediate with accumulator
+		case 0xff: rst(state, 7<<3); break; // RST 7
+	}
+	state->counters.instructions++;
+	if (state->recorder != NULL) {
+		trace_step(state->recorder, state);
+	}
+	return state->halted ? CORE_HALTED : CORE_OK;
+}
+
+core_status run_until(hw_state* state, uint64_t cycles) {
+	while (state->cycles < cycles) {
+		if (emulate(state) == CORE_HALTED) {
+			state->cycles = cycles; // nothing happens until the next interrupt, skip straight to it
+			return CORE_HALTED;
+		}
+	}
+	return state->halted ? CORE_HALTED : CORE_OK;
+}
+
+uint64_t frame_interrupt_due(hw_state* state) {
+	uint64_t frame_start = state->cycles - (state->cycles % CYCLES_PER_FRAME);
+	return frame_start + (state->frame_half ? CYCLES_PER_FRAME : CYCLES_PER_FRAME / 2);
+}
+
+void frame_interrupt(hw_state* state) {
+	generate_interrupt(state, state->frame_half ? 2 : 1);
+	state->frame_half = !state->frame_half;
+}
+
+void run_frame(hw_state* state) {
+	if (!state->frame_half) {
+		run_until(state, frame_interrupt_due(state));
+		frame_interrupt(state);
+	}
+	run_until(state, frame_interrupt_due(state));
+	frame_interrupt(state);
+}
+
+// 64 bit FNV-1a hash of the len bytes at data
+uint64_t hash_rom(const byte* data, long len) {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	for (long i = 0; i < len; i++) {
+		h ^= data[i];
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+/* ------------- LIBRARY --------------- */
+
+struct core {
+	hw_state state;
+	uint8_t* owned; // memory allocated by core_new, NULL if the caller supplied it
+};
+
+core* core_new(uint8_t* memory, const core_io* io) {
+	core* cpu = calloc(1, sizeof(core));
+	if (cpu == NULL) {
+		return NULL;
+	}
+	if (memory == NULL) {
+		memory = cpu->owned = calloc(CORE_MEMORY_SIZE, 1);
+		if (memory == NULL) {
+			free(cpu);
+			return NULL;
+		}
+	}
+	cpu->state.memory = memory;
+	if (io != NULL) {
+		cpu->state.io = *io;
+	}
+	return cpu;
+}
+
+void core_free(core* cpu) {
+	if (cpu != NULL) {
+		free(cpu->owned);
+		free(cpu);
+	}
+}
+
+hw_state* core_machine(core* cpu) {
+	return &cpu->state;
+}
+
+void core_reset(core* cpu) {
+	hw_state* state = &cpu->state;
+	state->a = state->b = state->c = state->d = state->e = state->h = state->l = 0;
+	state->sp = state->pc = state->op_pc = 0;
+	memset(&state->cc, 0, sizeof(state->cc));
+	state->interrupt_enabled = 0;
+	state->halted = 0;
+	state->frame_half = 0;
+	state->call_depth = 0;
+	state->cycles = 0;
+	memset(&state->counters, 0, sizeof(state->counters));
+}
+
+core_status core_step(core* cpu) {
+	return emulate(&cpu->state);
+}
+
+core_status core_run(core* cpu, uint64_t cycles) {
+	return run_until(&cpu->state, cpu->state.cycles + cycles);
+}
+
+core_status core_interrupt(core* cpu, int n) {
+	if (n < 0 || n > 7) {
+		return CORE_BAD_ARGUMENT;
+	}
+	generate_interrupt(&cpu->state, n);
+	return cpu->state.halted ? CORE_HALTED : CORE_OK;
+}
+
+void core_get_regs(core* cpu, core_regs* regs) {
+	hw_state* state = &cpu->state;
+	regs->a = state->a;
+	regs->f = get_psw(state) & 0xff;
+	regs->b = state->b;
+	regs->c = state->c;
+	regs->d = state->d;
+	regs->e = state->e;
+	regs->h = state->h;
+	regs->l = state->l;
+	regs->sp = state->sp;
+	regs->pc = state->pc;
+	regs->interrupt_enabled = state->interrupt_enabled;
+	regs->halted = state->halted;
+	regs->cycles = state->cycles;
+}
+
+void core_set_regs(core* cpu, const core_regs* regs) {
+	hw_state* state = &cpu->state;
+	set_psw(state, (regs->a << 8) | regs->f);
+	state->b = regs->b;
+	state->c = regs->c;
+	state->d = regs->d;
+	state->e = regs->e;
+	state->h = regs->h;
+	state->l = regs->l;
+	state->sp = regs->sp;
+	state->pc = regs->pc;
+	state->interrupt_enabled = regs->interrupt_enabled != 0;
+	state->halted = regs->halted != 0;
+	state->cycles = regs->cycles;
+}
+
+uint8_t* core_memory(core* cpu) {
+	return cpu->state.memory;
+}
+
+void core_set_memory(core* cpu, uint8_t* memory) {
+	if (cpu->owned != NULL && memory != cpu->owned) {
+		free(cpu->owned);
+		cpu->owned = NULL;
+	}
+	cpu->state.memory = memory;
+}
+
+core_status core_map_io(core* cpu, uint16_t start, uint16_t end) {
+	if (end < start) {
+		return CORE_BAD_ARGUMENT;
+	}
+	for (int page = start >> 8; page <= end >> 8; page++) {
+		cpu->state.slow_pages[page] |= PAGE_IO;
+	}
+	return CORE_OK;
+}
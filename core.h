@@ -0,0 +1,71 @@
+#ifndef CORE_H
+#define CORE_H
+#include <stdint.h>
+
+// The 8080 as a library. A core is an opaque machine context: any number of them can run in one
+// process, each with its own memory and callbacks. The core never exits the process, never
+// prints and keeps no global state, every result comes back as a status code.
+// Build it from core.c opcodes.c decode.c watch.c trace.c hle.c
+
+#define CORE_MEMORY_SIZE 0x10000
+
+typedef struct core core;
+
+typedef enum core_status {
+	CORE_OK = 0,
+	CORE_HALTED, // the machine has executed HLT and waits for an interrupt
+	CORE_BAD_ARGUMENT,
+} core_status;
+
+typedef struct core_io { // callbacks into the host, any of them may be NULL
+	void* user; // passed back to every callback
+	uint8_t (*in)(void* user, uint8_t port); // IN, leaves A unchanged when NULL
+	void (*out)(void* user, uint8_t port, uint8_t v); // OUT
+	uint8_t (*read)(void* user, uint16_t adr); // reads from pages mapped with core_map_io, 0xff when NULL
+	void (*write)(void* user, uint16_t adr, uint8_t v); // writes to those pages, dropped when NULL
+} core_io;
+
+typedef struct core_regs { // the registers as the host sees them
+	uint8_t a, f; // f is the condition bits as PUSH PSW stores them
+	uint8_t b, c, d, e, h, l;
+	uint16_t sp, pc;
+	uint8_t interrupt_enabled;
+	uint8_t halted;
+	uint64_t cycles; // clock cycles since reset
+} core_regs;
+
+// Creates a core in the reset state. memory is CORE_MEMORY_SIZE bytes owned by the caller, or NULL
+// for the core to allocate zeroed memory of its own. io is copied and may be NULL. Returns NULL if
+// out of memory
+core* core_new(uint8_t* memory, const core_io* io);
+void core_free(core* cpu);
+
+// Puts the registers back to their state at power on (PC 0, interrupts off, not halted) and clears
+// the cycle count, memory is left alone
+void core_reset(core* cpu);
+
+// Executes one instruction. Returns CORE_HALTED without doing anything while the machine is halted
+core_status core_step(core* cpu);
+
+// Executes instructions until cycles more clock cycles have elapsed. A halted machine lets the
+// clock run on to the end and returns CORE_HALTED
+core_status core_run(core* cpu, uint64_t cycles);
+
+// Raises interrupt n (0-7), which runs RST n and wakes a halted machine if interrupts are enabled
+core_status core_interrupt(core* cpu, int n);
+
+void core_get_regs(core* cpu, core_regs* regs);
+void core_set_regs(core* cpu, const core_regs* regs);
+
+// The memory the core runs on, CORE_MEMORY_SIZE bytes
+uint8_t* core_memory(core* cpu);
+
+// Moves the core onto other memory, owned by the caller, e.g. to take a machine's memory away while
+// it is idle. Memory the core allocated itself is freed. The core must not run while memory is NULL
+void core_set_memory(core* cpu, uint8_t* memory);
+
+// Sends reads and writes of start..end (inclusive) to the read and write callbacks instead of
+// memory. Mapping works on 256 byte pages, so every page the range touches is mapped
+core_status core_map_io(core* cpu, uint16_t start, uint16_t end);
+
+#endif
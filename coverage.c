@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "coverage.h"
+
+void coverage_merge(coverage_map* dst, const coverage_map* src) {
+	for (int i = 0; i < COVERAGE_WORDS; i++) {
+		dst->executed[i] |= src->executed[i];
+	}
+	for (int i = 0; i < 2 * COVERAGE_WORDS; i++) {
+		dst->edges[i] |= src->edges[i];
+	}
+}
+
+void coverage_count(const coverage_map* map, uint32_t* instructions, uint32_t* edges) {
+	*instructions = 0;
+	*edges = 0;
+	for (int i = 0; i < COVERAGE_WORDS; i++) {
+		*instructions += __builtin_popcountll(map->executed[i]);
+	}
+	for (int i = 0; i < 2 * COVERAGE_WORDS; i++) {
+		*edges += __builtin_popcountll(map->edges[i]);
+	}
+}
+
+int coverage_save(const coverage_map* map, uint64_t rom_hash, const char* path) {
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long) getpid());
+	FILE* fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		return 0;
+	}
+	coverage_header hdr = {.version = COVERAGE_VERSION, .rom_hash = rom_hash};
+	memcpy(hdr.magic, COVERAGE_MAGIC, 8);
+	int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+		&& fwrite(map, sizeof(*map), 1, fp) == 1;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmp_path, path) != 0) {
+		remove(tmp_path);
+		return 0;
+	}
+	return 1;
+}
+
+int coverage_load(coverage_map* map, uint64_t* rom_hash, const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return 0;
+	}
+	coverage_header hdr;
+	int ok = fread(&hdr, sizeof(hdr), 1, fp) == 1
+		&& memcmp(hdr.magic, COVERAGE_MAGIC, 8) == 0
+		&& hdr.version == COVERAGE_VERSION
+		&& (*rom_hash == 0 || hdr.rom_hash == *rom_hash)
+		&& fseek(fp, 0, SEEK_END) == 0
+		&& ftell(fp) == (long) (sizeof(hdr) + sizeof(*map))
+		&& fseek(fp, sizeof(hdr), SEEK_SET) == 0;
+	coverage_map* file = NULL; // map is only touched once the whole file has been read
+	ok = ok && (file = malloc(sizeof(coverage_map))) != NULL
+		&& fread(file, sizeof(*file), 1, fp) == 1;
+	fclose(fp);
+	if (ok) {
+		coverage_merge(map, file);
+		*rom_hash = hdr.rom_hash;
+	}
+	free(file);
+	return ok;
+}
@@ -0,0 +1,50 @@
+#ifndef COVERAGE_H
+#define COVERAGE_H
+#include <stdint.h>
+
+#define COVERAGE_SIZE 0x10000 // addresses covered, the whole 8080 address space
+#define COVERAGE_WORDS (COVERAGE_SIZE / 64)
+#define COVERAGE_MAGIC "8080COVR"
+#define COVERAGE_VERSION 1
+
+// Which guest code has run. Recording sets one bit per instruction, plus one per conditional jump,
+// call or return for the way it went. Maps only ever gain bits, so merging two is an OR and the
+// order runs are merged in does not matter
+typedef struct coverage_map {
+	uint64_t executed[COVERAGE_WORDS]; // bit adr: an instruction starting at adr has executed
+	uint64_t edges[2 * COVERAGE_WORDS]; // bit adr * 2: the conditional at adr fell through, adr * 2 + 1: it was taken
+} coverage_map;
+
+// File layout: this header, then executed and edges as little endian 64 bit words
+typedef struct coverage_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t pad;
+	uint64_t rom_hash; // hash_rom of the ROM the coverage is of, maps of different ROMs do not merge
+} coverage_header;
+
+static inline int coverage_executed(const coverage_map* map, uint16_t adr) {
+	return (map->executed[adr >> 6] >> (adr & 63)) & 1;
+}
+
+// Whether the conditional at adr has been taken (taken = 1) or has fallen through (taken = 0)
+static inline int coverage_edge(const coverage_map* map, uint16_t adr, int taken) {
+	uint32_t edge = (adr << 1) | taken;
+	return (map->edges[edge >> 6] >> (edge & 63)) & 1;
+}
+
+// Adds the coverage in src to dst
+void coverage_merge(coverage_map* dst, const coverage_map* src);
+
+// Counts the instructions executed and the directions of conditionals seen
+void coverage_count(const coverage_map* map, uint32_t* instructions, uint32_t* edges);
+
+// Writes map to path through a temporary file, so a reader never sees half a map. Returns 1 on success
+int coverage_save(const coverage_map* map, uint64_t rom_hash, const char* path);
+
+// Merges the map in the file at path into map. If *rom_hash is 0 it is set from the file, otherwise
+// the file must be of the same ROM. Returns 1 on success, 0 if the file is missing, invalid or of
+// another ROM
+int coverage_load(coverage_map* map, uint64_t* rom_hash, const char* path);
+
+#endif
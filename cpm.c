@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpm.h"
+#include "emulator.h"
+#include "trace.h"
+
+#define CPM_LINE 256 // console output is checked for failure messages a line at a time
+
+typedef struct cpm_console { // console output of the program being run
+	FILE* out;
+	char line[CPM_LINE];
+	int len;
+	int failed; // set when a line reports an error
+} cpm_console;
+
+// Returns host monotonic time in seconds
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Prints c to the console, checking each completed line for an error report from the test ROM
+static void console_putc(cpm_console* con, char c) {
+	fputc(c, con->out);
+	if (c == '\n' || con->len == CPM_LINE - 1) {
+		con->line[con->len] = '\0';
+		if (strstr(con->line, "ERROR") || strstr(con->line, "FAIL")) {
+			con->failed = 1;
+		}
+		con->len = 0;
+	} else if (c != '\r') {
+		con->line[con->len++] = c;
+	}
+}
+
+// Handles a call to the BDOS natively, then returns to the caller
+static void bdos(hw_state* state, cpm_console* con) {
+	switch (state->c) {
+		case 2: // console output of the character in E
+			console_putc(con, state->e);
+			break;
+		case 9: { // print the '$' terminated string at DE
+			uint16_t adr = (state->d << 8) | state->e;
+			for (int i = 0; i < MEMORY_SIZE && state->memory[adr] != '$'; i++, adr++) {
+				console_putc(con, state->memory[adr]);
+			}
+			break;
+		}
+	}
+	state->pc = pop_16(state); // return from the CALL 5
+}
+
+int run_cpm(const char* path, FILE* out, const char* trace_path) {
+	byte* memory = calloc(MEMORY_SIZE, sizeof(byte));
+	FILE* fp = fopen(path, "rb");
+	if (memory == NULL || fp == NULL) {
+		free(memory);
+		if (fp != NULL) {
+			fclose(fp);
+		}
+		return -1;
+	}
+	size_t numbytes = fread(&memory[CPM_TPA], sizeof(byte), MEMORY_SIZE - CPM_TPA, fp);
+	int read_ok = numbytes > 0 && !ferror(fp);
+	fclose(fp);
+	if (!read_ok) { // an empty TPA would only report a meaningless FAIL
+		free(memory);
+		return -1;
+	}
+
+	// the top of the TPA is read from the operand of the JMP at the BDOS entry, put the stack below it
+	memory[CPM_BDOS] = 0xc3;
+	memory[CPM_BDOS+1] = 0x00;
+	memory[CPM_BDOS+2] = 0xf0;
+	memory[0] = 0x76; // warm boot, the program has finished
+
+	core* cpu = core_new(memory, NULL); // test programs use the BDOS, not the ports
+	if (cpu == NULL) {
+		free(memory);
+		return -1;
+	}
+	core_regs regs;
+	core_get_regs(cpu, &regs);
+	regs.pc = CPM_TPA;
+	regs.sp = 0xf000;
+	core_set_regs(cpu, &regs);
+	hw_state* state = core_machine(cpu); // the BDOS and the trace work on the machine directly
+
+	cpm_console con = {.out = out};
+	trace_recorder recorder;
+	if (trace_path != NULL && !trace_open(&recorder, state, trace_path)) {
+		fprintf(out, "Could not create trace %s\n", trace_path);
+		core_free(cpu);
+		free(memory);
+		return 0;
+	}
+	int halted = 0;
+	double start = now();
+	for (;;) {
+		if (state->pc == CPM_BDOS) {
+			bdos(state, &con);
+		} else if (state->pc == 0) {
+			break;
+		} else if (memory[state->pc] == 0x76) {
+			halted = 1; // test ROMs halt when they fail
+			break;
+		} else {
+			emulate(state);
+		}
+	}
+	double seconds = now() - start;
+	if (trace_path != NULL && !trace_close(&recorder, state)) {
+		fprintf(out, "Could not write trace %s\n", trace_path);
+	}
+	if (con.len > 0) {
+		console_putc(&con, '\n');
+	}
+
+	int passed = !con.failed && !halted;
+	fprintf(out, "%s: %s, %llu instructions, %llu cycles in %.3f s (%.2f MIPS, %.2f MHz)\n",
+		path, passed ? "PASS" : "FAIL",
+		(unsigned long long) state->counters.instructions, (unsigned long long) state->cycles, seconds,
+		seconds > 0 ? state->counters.instructions / seconds / 1e6 : 0,
+		seconds > 0 ? state->cycles / seconds / 1e6 : 0);
+	core_free(cpu);
+	free(memory);
+	return passed;
+}
@@ -0,0 +1,15 @@
+#ifndef CPM_H
+#define CPM_H
+#include <stdio.h>
+
+#define CPM_TPA 0x100 // CP/M loads .COM programs here
+#define CPM_BDOS 0x0005 // programs call the BDOS at this address
+
+// Runs the CP/M program in the .COM file at path with tracing off, printing its console output and
+// a summary with the elapsed time and MIPS to out. Returns 1 if the program passed, 0 if it failed
+// (printed an error or halted instead of returning to CP/M) and -1 if the file could not be read, is
+// empty or there is no memory to run it.
+// If trace_path is not NULL a binary trace of the run is written there, see trace.h
+int run_cpm(const char* path, FILE* out, const char* trace_path);
+
+#endif
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include "decode.h"
+#include "opcodes.h"
+
+// writes the mnemonic of the instruction starting at byte bin_code[pc] into buf, returns the size of the instruction
+int format_op(char* buf, size_t len, const BYTE* bin_code, int pc) {
+	const BYTE* pointer = &bin_code[pc];
+	const op_info* info = &op_table[*pointer];
+	// Each "register pair" is denoted by the first register. E.g. 'B' can refer to the pair B, C
+	switch (info->operand) {
+		case OPND_NONE: snprintf(buf, len, "%s", info->name); break;
+		case OPND_D8: snprintf(buf, len, "%s#$%02x", info->name, pointer[1]); break;
+		case OPND_D16: snprintf(buf, len, "%s#$%02x%02x", info->name, pointer[2], pointer[1]); break;
+		case OPND_ADDR: snprintf(buf, len, "%s$%02X%02X", info->name, pointer[2], pointer[1]); break;
+	}
+	return info->size;
+}
+
+// prints the instruction starting at byte bin_code[pc], returns the size of the instruction
+int decode_op(BYTE* bin_code, int pc) {
+	char text[32];
+	int size = format_op(text, sizeof(text), bin_code, pc);
+	printf("%s\n", text);
+	return size;
+}
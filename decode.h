@@ -0,0 +1,12 @@
+#ifndef DECODE_H
+#define DECODE_H
+#include <stddef.h>
+typedef unsigned char BYTE;
+
+// writes the mnemonic of the instruction starting at byte bin_code[pc] into buf, returns the size of the instruction
+int format_op(char* buf, size_t len, const BYTE* bin_code, int pc);
+
+// prints the instruction starting at byte bin_code[pc], returns the size of the instruction
+int decode_op(BYTE* bin_code, int pc);
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef EMULATOR_H
+#define EMULATOR_H
+#include <stdio.h>
+#include <stdint.h>
+#include "core.h"
+
+#define MEMORY_SIZE CORE_MEMORY_SIZE // the 8080 can address 64K of memory
+#define CLOCK_HZ 2000000 // Space Invaders runs the 8080 at 2MHz
+#define FRAME_HZ 60
+#define CYCLES_PER_FRAME (CLOCK_HZ / FRAME_HZ)
+#define PAGE_SIZE 0x100 // granularity at which memory accesses can be routed to the slow path
+#define NUM_PAGES (MEMORY_SIZE / PAGE_SIZE)
+#define PAGE_WATCH 0x01 // slow_pages bit: the page holds a watchpoint
+#define PAGE_TRACE 0x02 // slow_pages bit: writes to the page are being traced
+#define PAGE_IO 0x04 // slow_pages bit: the page is mapped to the host with core_map_io
+#define CALL_STACK_DEPTH 64 // guest calls and interrupts tracked by the shadow call stack, the outermost are dropped beyond this
+
+typedef unsigned char byte;
+typedef struct c_bits { // condition code bits
+	uint8_t z:1; // zero bit, set when the result is zero
+	uint8_t s:1; // sign bit, set when the sign of the result is negative
+	uint8_t p:1; // parity bit, set when even number of 1s in result
+	uint8_t cy:1; // carry bit, set when result includes a carry out
+	uint8_t ac:1; // auxilary carry, set when result includes a carry out of bit 3
+	uint8_t pad:3; // ???
+} c_bits;
+typedef struct hw_counters { // running totals kept by the processor, see stats.h
+	uint64_t instructions; // instructions retired
+	uint64_t interrupts; // interrupts delivered
+	uint64_t port_reads; // IN instructions executed
+	uint64_t port_writes; // OUT instructions executed
+} hw_counters;
+typedef struct hw_state { // state of the processor
+	uint8_t a;
+	uint8_t b;
+	uint8_t c;
+	uint8_t d;
+	uint8_t e;
+	uint8_t h;
+	uint8_t l;
+	uint16_t sp; // stack pointer - grows upwards (toward lower addresses)
+	uint16_t pc; // program counter
+	uint8_t* memory; // main memory
+	uint8_t slow_pages[NUM_PAGES]; // PAGE_ bits for pages whose accesses go through mem_read_slow and mem_write_slow
+	struct watch_list* watch; // watchpoints, see watch.h
+	struct hle_set* hle; // native replacements for guest subroutines, see hle.h
+	struct trace_recorder* recorder; // binary trace being written, see trace.h
+	struct coverage_map* coverage; // code coverage being recorded, see coverage.h
+	uint16_t op_pc; // address of the instruction being executed
+	uint16_t call_stack[CALL_STACK_DEPTH]; // return address of each active CALL, RST and interrupt, innermost last
+	uint16_t call_sp[CALL_STACK_DEPTH]; // SP just after each of those return addresses was pushed
+	int call_depth; // entries in call_stack
+	struct c_bits cc; // condition bits
+	uint8_t interrupt_enabled;
+	uint8_t halted; // HLT has been executed, nothing runs until an interrupt
+	uint8_t frame_half; // 0 while the mid-screen interrupt (RST 1) of this frame is due next, 1 while vblank (RST 2) is
+	FILE* trace; // print each instruction to this as it is executed, NULL for none
+	uint64_t cycles; // number of clock cycles executed since reset
+	hw_counters counters;
+	core_io io; // ports and memory mapped devices, see core.h
+} hw_state;
+
+uint8_t mem_read_slow(hw_state* state, uint16_t adr);
+void mem_write_slow(hw_state* state, uint16_t adr, uint8_t v);
+
+// Reads guest memory. Only pages marked in slow_pages (e.g. watched ones) leave the fast path
+static inline uint8_t mem_read(hw_state* state, uint16_t adr) {
+	if (state->slow_pages[adr >> 8]) {
+		return mem_read_slow(state, adr);
+	}
+	return state->memory[adr];
+}
+
+// Writes guest memory, see mem_read
+static inline void mem_write(hw_state* state, uint16_t adr, uint8_t v) {
+	if (state->slow_pages[adr >> 8]) {
+		mem_write_slow(state, adr, v);
+	} else {
+		state->memory[adr] = v;
+	}
+}
+
+// Instruction helpers, shared with the native subroutines in hle.c so they set the condition bits
+// and use the stack exactly as the instructions do
+void push(hw_state* state, uint16_t v);
+void ret(hw_state* state);
+void dcr(hw_state* state, char reg);
+void dad(hw_state* state, char reg);
+
+uint16_t get_psw(hw_state* state);
+void set_psw(hw_state* state, uint16_t psw);
+uint16_t pop_16(hw_state* state);
+
+// Pushes the PC and jumps to the handler for RST n, if interrupts are enabled, waking a halted machine
+void generate_interrupt(hw_state* state, int n);
+
+// Executes next instruction for processor in state hw_state. Returns CORE_HALTED, doing nothing,
+// while the machine is halted
+core_status emulate(hw_state* state);
+
+// Runs until the clock reaches cycles, letting a halted machine's clock run on to it
+core_status run_until(hw_state* state, uint64_t cycles);
+
+// The machine inside a core, for the tools built into the emulator that work on hw_state directly
+hw_state* core_machine(core* cpu);
+
+// 64 bit FNV-1a hash of the len bytes at data, identifies a ROM
+uint64_t hash_rom(const byte* data, long len);
+
+// Reads the ROM at filename into the start of memory, returns the number of bytes read or -1 on error
+long load_rom(const char* filename, byte* memory);
+
+// Cycle count at which the next frame interrupt is due: mid-screen in the first half of the frame,
+// vblank in the second
+uint64_t frame_interrupt_due(hw_state* state);
+
+// Delivers the frame interrupt that is due, RST 1 or RST 2, and moves on to the other half of the frame
+void frame_interrupt(hw_state* state);
+
+// Runs to the end of the current video frame, delivering the mid-screen (RST 1) and vblank (RST 2)
+// interrupts. A machine stopped part way through a frame carries on from there
+void run_frame(hw_state* state);
+
+#endif
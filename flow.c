@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "flow.h"
+#include "opcodes.h"
+
+// Returns 1 if the instruction ends a basic block
+static int ends_block(BYTE op) {
+	return op_table[op].ctrl != CTRL_NEXT && op_table[op].ctrl != CTRL_CALL &&
+		op_table[op].ctrl != CTRL_CALL_IF && op_table[op].ctrl != CTRL_RST;
+}
+
+typedef struct walker { // work list for following control flow
+	flow_analysis* flow;
+	uint16_t* work;
+	int top;
+	uint8_t* queued;
+	int32_t* ref_to; // target of the jump or call at each address, -1 if none
+	uint8_t* ref_kind;
+} walker;
+
+static void enqueue(walker* w, uint32_t adr) {
+	if (adr < w->flow->image_len && !w->queued[adr]) {
+		w->queued[adr] = 1;
+		w->work[w->top++] = adr;
+	}
+}
+
+// Records a jump or call from pc to target and queues the target for decoding
+static void add_ref(walker* w, uint32_t pc, uint16_t target, int kind, uint8_t flag) {
+	w->ref_to[pc] = target;
+	w->ref_kind[pc] = kind;
+	w->flow->flags[target] |= flag | FLOW_BLOCK;
+	enqueue(w, target);
+}
+
+// Decodes instructions from pc until control cannot fall through any further
+static void walk(walker* w, const BYTE* image, uint32_t pc) {
+	flow_analysis* flow = w->flow;
+	while (pc < flow->image_len) {
+		if (flow->flags[pc] & FLOW_CODE) {
+			flow->flags[pc] |= FLOW_BLOCK; // reached both by falling through and from elsewhere
+			return;
+		}
+		BYTE op = image[pc];
+		int n = op_table[op].size;
+		if (pc + n > flow->image_len) {
+			return; // instruction is cut off by the end of the image
+		}
+		if (flow->flags[pc] & FLOW_OPERAND) {
+			flow->flags[pc] |= FLOW_OVERLAP;
+		}
+		flow->flags[pc] |= FLOW_CODE;
+		for (int i = 1; i < n; i++) {
+			if (flow->flags[pc+i] & FLOW_CODE) {
+				flow->flags[pc+i] |= FLOW_OVERLAP;
+			}
+			flow->flags[pc+i] |= FLOW_OPERAND;
+		}
+		uint16_t target = n == 3 ? (image[pc+2] << 8) | image[pc+1] : 0;
+		switch (op_table[op].ctrl) {
+			case CTRL_JUMP: add_ref(w, pc, target, XREF_JUMP, FLOW_TARGET); return;
+			case CTRL_BRANCH: add_ref(w, pc, target, XREF_BRANCH, FLOW_TARGET); break;
+			case CTRL_CALL: add_ref(w, pc, target, XREF_CALL, FLOW_SUB); break;
+			case CTRL_CALL_IF: add_ref(w, pc, target, XREF_CALL_IF, FLOW_SUB); break;
+			case CTRL_RST: add_ref(w, pc, op & 0x38, XREF_RST, FLOW_SUB); break;
+			case CTRL_RET: case CTRL_JUMP_INDIRECT: case CTRL_HALT: return; // target unknown or none
+		}
+		pc += n;
+		if (ends_block(op) && pc < flow->image_len) {
+			flow->flags[pc] |= FLOW_BLOCK;
+		}
+	}
+}
+
+// Splits the decoded instructions into basic blocks, in address order
+static int build_blocks(flow_analysis* flow, const BYTE* image) {
+	flow->blocks = malloc(FLOW_IMAGE_SIZE * sizeof(flow_block));
+	if (flow->blocks == NULL) {
+		return 0;
+	}
+	uint32_t expected = 0; // address following the previous instruction
+	int open = 0; // the current block can be extended
+	for (uint32_t pc = 0; pc < flow->image_len; pc++) {
+		if (!(flow->flags[pc] & FLOW_CODE)) {
+			continue;
+		}
+		BYTE op = image[pc];
+		if (!open || pc != expected || (flow->flags[pc] & FLOW_BLOCK)) {
+			flow->flags[pc] |= FLOW_BLOCK;
+			flow->blocks[flow->num_blocks++] = (flow_block) {.start = pc};
+		}
+		expected = pc + op_table[op].size;
+		flow->blocks[flow->num_blocks-1].len = expected - flow->blocks[flow->num_blocks-1].start;
+		open = !ends_block(op);
+	}
+	return 1;
+}
+
+// Groups the references by target address, each group in order of source address
+static int build_xrefs(flow_analysis* flow, walker* w) {
+	uint32_t* count = flow->xref_start;
+	memset(count, 0, sizeof(flow->xref_start));
+	for (uint32_t pc = 0; pc < flow->image_len; pc++) {
+		if (w->ref_to[pc] >= 0) {
+			count[w->ref_to[pc] + 1]++;
+			flow->num_xrefs++;
+		}
+	}
+	for (uint32_t adr = 0; adr < FLOW_IMAGE_SIZE; adr++) {
+		count[adr+1] += count[adr];
+	}
+	flow->xrefs = malloc((flow->num_xrefs + 1) * sizeof(flow_xref));
+	uint32_t* next = malloc(FLOW_IMAGE_SIZE * sizeof(uint32_t));
+	if (flow->xrefs == NULL || next == NULL) {
+		free(next);
+		return 0;
+	}
+	memcpy(next, flow->xref_start, FLOW_IMAGE_SIZE * sizeof(uint32_t));
+	for (uint32_t pc = 0; pc < flow->image_len; pc++) {
+		if (w->ref_to[pc] >= 0) {
+			flow->xrefs[next[w->ref_to[pc]]++] = (flow_xref) {.from = pc, .kind = w->ref_kind[pc]};
+		}
+	}
+	free(next);
+	return 1;
+}
+
+flow_analysis* flow_analyse(const BYTE* image, uint32_t len) {
+	flow_analysis* flow = calloc(1, sizeof(flow_analysis));
+	walker w = {
+		.flow = flow,
+		.work = malloc(FLOW_IMAGE_SIZE * sizeof(uint16_t)),
+		.queued = calloc(FLOW_IMAGE_SIZE, 1),
+		.ref_to = malloc(FLOW_IMAGE_SIZE * sizeof(int32_t)),
+		.ref_kind = malloc(FLOW_IMAGE_SIZE),
+	};
+	int ok = flow && w.work && w.queued && w.ref_to && w.ref_kind;
+	if (ok) {
+		flow->image_len = len < FLOW_IMAGE_SIZE ? len : FLOW_IMAGE_SIZE;
+		memset(w.ref_to, 0xff, FLOW_IMAGE_SIZE * sizeof(int32_t));
+		// Follow everything reachable from reset first. An RST vector that no RST instruction uses is
+		// only an entry point if it does not fall inside code already found, since ROMs commonly
+		// place ordinary code over the vectors of interrupts their hardware never raises
+		for (uint32_t v = 0; v < 0x40 && v < flow->image_len; v += 8) {
+			if (v == 0 || !(flow->flags[v] & (FLOW_CODE | FLOW_OPERAND))) {
+				flow->flags[v] |= FLOW_ENTRY | FLOW_BLOCK | (v ? FLOW_SUB : 0);
+				enqueue(&w, v);
+			}
+			while (w.top > 0) {
+				walk(&w, image, w.work[--w.top]);
+			}
+		}
+		ok = build_blocks(flow, image) && build_xrefs(flow, &w);
+	}
+	free(w.work);
+	free(w.queued);
+	free(w.ref_to);
+	free(w.ref_kind);
+	if (!ok) {
+		flow_free(flow);
+		return NULL;
+	}
+	return flow;
+}
+
+void flow_free(flow_analysis* flow) {
+	if (flow != NULL) {
+		free(flow->blocks);
+		free(flow->xrefs);
+		free(flow);
+	}
+}
+
+int flow_write_index(flow_analysis* flow, const char* path) {
+	FILE* fp = fopen(path, "wb");
+	if (fp == NULL) {
+		return 0;
+	}
+	flow_header hdr = {.version = FLOW_VERSION, .image_len = flow->image_len,
+		.num_blocks = flow->num_blocks, .num_xrefs = flow->num_xrefs};
+	memcpy(hdr.magic, FLOW_MAGIC, 8);
+	int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1
+		&& fwrite(flow->flags, 1, FLOW_IMAGE_SIZE, fp) == FLOW_IMAGE_SIZE
+		&& fwrite(flow->blocks, sizeof(flow_block), flow->num_blocks, fp) == flow->num_blocks
+		&& fwrite(flow->xref_start, sizeof(uint32_t), FLOW_IMAGE_SIZE + 1, fp) == FLOW_IMAGE_SIZE + 1
+		&& fwrite(flow->xrefs, sizeof(flow_xref), flow->num_xrefs, fp) == flow->num_xrefs;
+	return (fclose(fp) == 0) && ok;
+}
+
+static const char* xref_names[] = {"JMP", "Jcc", "CALL", "Ccc", "RST"};
+
+// Returns 1 if the tables of an index read from a file are consistent, so the listing and lookups
+// can index flags, blocks and xrefs with them without going out of bounds
+static int index_valid(flow_analysis* flow) {
+	if (flow->image_len > FLOW_IMAGE_SIZE || flow->xref_start[FLOW_IMAGE_SIZE] != flow->num_xrefs) {
+		return 0;
+	}
+	for (uint32_t adr = 0; adr < FLOW_IMAGE_SIZE; adr++) {
+		if (flow->xref_start[adr] > flow->xref_start[adr+1]) {
+			return 0;
+		}
+	}
+	for (uint32_t i = 0; i < flow->num_xrefs; i++) {
+		if (flow->xrefs[i].kind >= sizeof(xref_names) / sizeof(xref_names[0])) {
+			return 0;
+		}
+	}
+	for (uint32_t i = 0; i < flow->num_blocks; i++) {
+		if ((uint32_t) flow->blocks[i].start + flow->blocks[i].len > flow->image_len) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+flow_analysis* flow_read_index(const char* path) {
+	FILE* fp = fopen(path, "rb");
+	if (fp == NULL) {
+		return NULL;
+	}
+	flow_header hdr;
+	flow_analysis* flow = calloc(1, sizeof(flow_analysis));
+	int ok = flow != NULL
+		&& fread(&hdr, sizeof(hdr), 1, fp) == 1
+		&& memcmp(hdr.magic, FLOW_MAGIC, 8) == 0
+		&& hdr.version == FLOW_VERSION
+		&& hdr.num_blocks <= FLOW_IMAGE_SIZE
+		&& hdr.num_xrefs <= FLOW_IMAGE_SIZE;
+	if (ok) {
+		flow->image_len = hdr.image_len;
+		flow->num_blocks = hdr.num_blocks;
+		flow->num_xrefs = hdr.num_xrefs;
+		flow->blocks = malloc((hdr.num_blocks + 1) * sizeof(flow_block));
+		flow->xrefs = malloc((hdr.num_xrefs + 1) * sizeof(flow_xref));
+		ok = flow->blocks && flow->xrefs
+			&& fread(flow->flags, 1, FLOW_IMAGE_SIZE, fp) == FLOW_IMAGE_SIZE
+			&& fread(flow->blocks, sizeof(flow_block), hdr.num_blocks, fp) == hdr.num_blocks
+			&& fread(flow->xref_start, sizeof(uint32_t), FLOW_IMAGE_SIZE + 1, fp) == FLOW_IMAGE_SIZE + 1
+			&& fread(flow->xrefs, sizeof(flow_xref), hdr.num_xrefs, fp) == hdr.num_xrefs
+			&& index_valid(flow);
+	}
+	fclose(fp);
+	if (!ok) {
+		flow_free(flow);
+		return NULL;
+	}
+	return flow;
+}
+
+// Prints the label for the block starting at adr and where it is reached from
+static void write_label(flow_analysis* flow, uint32_t adr, FILE* out) {
+	uint8_t f = flow->flags[adr];
+	fprintf(out, "\n%s_%04X:", (f & (FLOW_SUB | FLOW_ENTRY)) ? "sub" : "L", adr);
+	uint32_t first = flow->xref_start[adr];
+	uint32_t last = flow->xref_start[adr+1];
+	for (uint32_t i = first; i < last && i < first + 8; i++) {
+		fprintf(out, "%s %s %04X", i == first ? " ;" : ",", xref_names[flow->xrefs[i].kind], flow->xrefs[i].from);
+	}
+	if (last - first > 8) {
+		fprintf(out, " and %u more", last - first - 8);
+	}
+	fprintf(out, "\n");
+}
+
+void flow_write_listing(flow_analysis* flow, const BYTE* image, FILE* out) {
+	char text[32];
+	uint32_t pc = 0;
+	while (pc < flow->image_len) {
+		uint8_t f = flow->flags[pc];
+		if (f & FLOW_CODE) {
+			if (f & (FLOW_BLOCK | FLOW_SUB | FLOW_TARGET | FLOW_ENTRY)) {
+				write_label(flow, pc, out);
+			}
+			format_op(text, sizeof(text), image, pc);
+			fprintf(out, "%04X %s%s\n", pc, text, (f & FLOW_OVERLAP) ? " ; overlaps previous instruction" : "");
+			pc++; // operands are skipped below, unless another instruction starts inside them
+		} else if (f & FLOW_OPERAND) {
+			pc++;
+		} else {
+			fprintf(out, "%04X DB ", pc); // bytes never reached as code, eight to a line
+			for (int i = 0; i < 8 && pc < flow->image_len && !(flow->flags[pc] & (FLOW_CODE | FLOW_OPERAND)); i++, pc++) {
+				fprintf(out, "%s$%02X", i ? "," : "", image[pc]);
+			}
+			fprintf(out, "\n");
+		}
+	}
+}
+
+// Returns 1 if op is a conditional jump, call or return
+static int conditional(BYTE op) {
+	return op_table[op].ctrl == CTRL_BRANCH || op_table[op].ctrl == CTRL_CALL_IF || op_table[op].ctrl == CTRL_RET_IF;
+}
+
+void flow_write_coverage(flow_analysis* flow, const BYTE* image, const coverage_map* map, FILE* out) {
+	uint32_t instructions = 0, executed = 0, directions = 0, seen = 0;
+	for (uint32_t pc = 0; pc < flow->image_len; pc++) {
+		if ((flow->flags[pc] & FLOW_CODE) || coverage_executed(map, pc)) {
+			instructions++;
+			executed += coverage_executed(map, pc);
+			if (conditional(image[pc])) {
+				directions += 2;
+				seen += coverage_edge(map, pc, 0) + coverage_edge(map, pc, 1);
+			}
+		}
+	}
+	fprintf(out, "coverage: %u of %u instructions executed (%.1f%%), %u of %u conditional directions (%.1f%%)\n",
+		executed, instructions, instructions ? 100.0 * executed / instructions : 0,
+		seen, directions, directions ? 100.0 * seen / directions : 0);
+
+	char text[32];
+	uint32_t next = 0; // address following the last line printed, to separate runs with a blank line
+	for (uint32_t pc = 0; pc < flow->image_len; pc++) {
+		if (!(flow->flags[pc] & FLOW_CODE) && !coverage_executed(map, pc)) {
+			continue;
+		}
+		const char* note;
+		if (!coverage_executed(map, pc)) {
+			note = " ; not executed";
+		} else if (!conditional(image[pc]) || (coverage_edge(map, pc, 0) && coverage_edge(map, pc, 1))) {
+			continue;
+		} else if (coverage_edge(map, pc, 1)) {
+			note = " ; always taken";
+		} else {
+			note = " ; never taken";
+		}
+		if (pc != next) {
+			fprintf(out, "\n");
+		}
+		int size = format_op(text, sizeof(text), image, pc);
+		fprintf(out, "%04X %-16s%s\n", pc, text, note);
+		next = pc + size;
+	}
+}
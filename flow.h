@@ -0,0 +1,82 @@
+#ifndef FLOW_H
+#define FLOW_H
+#include <stdio.h>
+#include <stdint.h>
+#include "decode.h"
+#include "coverage.h"
+
+#define FLOW_IMAGE_SIZE 0x10000 // largest image that can be analysed, the whole 8080 address space
+#define FLOW_MAGIC "8080XREF"
+#define FLOW_VERSION 1
+
+// Flags recorded for each address of the image
+#define FLOW_CODE 0x01 // first byte of an instruction reached from an entry point
+#define FLOW_OPERAND 0x02 // operand byte of an instruction
+#define FLOW_BLOCK 0x04 // first instruction of a basic block
+#define FLOW_SUB 0x08 // target of a CALL or RST
+#define FLOW_TARGET 0x10 // target of a JMP or Jcc
+#define FLOW_ENTRY 0x20 // reset or RST vector the analysis started from
+#define FLOW_OVERLAP 0x40 // an instruction starts inside the operands of another instruction
+
+// Kinds of cross-reference
+#define XREF_JUMP 0 // JMP
+#define XREF_BRANCH 1 // conditional jump
+#define XREF_CALL 2 // CALL
+#define XREF_CALL_IF 3 // conditional call
+#define XREF_RST 4 // RST
+
+typedef struct flow_xref { // a jump or call to an address, stored grouped by target address
+	uint16_t from; // address of the jumping instruction
+	uint8_t kind;
+	uint8_t pad;
+} flow_xref;
+
+typedef struct flow_block { // a straight-line run of instructions with a single entry
+	uint16_t start;
+	uint16_t len; // bytes, the block ends at start + len
+} flow_block;
+
+// The binary index is this header followed by flags[FLOW_IMAGE_SIZE], blocks[num_blocks],
+// xref_start[FLOW_IMAGE_SIZE + 1] and xrefs[num_xrefs], all little endian. The xrefs to address
+// adr are xrefs[xref_start[adr]] up to xrefs[xref_start[adr+1]]
+typedef struct flow_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t image_len;
+	uint32_t num_blocks;
+	uint32_t num_xrefs;
+} flow_header;
+
+typedef struct flow_analysis {
+	uint32_t image_len;
+	uint8_t flags[FLOW_IMAGE_SIZE];
+	flow_block* blocks;
+	uint32_t num_blocks;
+	uint32_t xref_start[FLOW_IMAGE_SIZE + 1];
+	flow_xref* xrefs;
+	uint32_t num_xrefs;
+} flow_analysis;
+
+// Follows control flow from the reset and RST vectors of the len byte image, splitting the code it
+// reaches into basic blocks and indexing every jump and call by target. Returns NULL if out of memory
+flow_analysis* flow_analyse(const BYTE* image, uint32_t len);
+void flow_free(flow_analysis* flow);
+
+// Writes the binary index described above, returns 1 on success
+int flow_write_index(flow_analysis* flow, const char* path);
+
+// Loads a binary index written by flow_write_index, returns NULL if it is missing, truncated or its
+// tables are inconsistent (an image longer than FLOW_IMAGE_SIZE, xrefs or blocks out of range)
+flow_analysis* flow_read_index(const char* path);
+
+// Writes a labelled listing of image, with code reached from an entry point disassembled and
+// everything else shown as data
+void flow_write_listing(flow_analysis* flow, const BYTE* image, FILE* out);
+
+// Writes a coverage report of image: the share of instructions and conditional directions that
+// have executed, then each instruction never executed and each conditional seen going only one way,
+// in address order. Instructions come from the analysis and from map, so code only reached through
+// PCHL or a table counts once it has run
+void flow_write_coverage(flow_analysis* flow, const BYTE* image, const coverage_map* map, FILE* out);
+
+#endif
@@ -0,0 +1,750 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "fuzz.h"
+#include "emulator.h"
+#include "opcodes.h"
+#include "decode.h"
+
+#define FUZZ_MAX_WRITES (FUZZ_MAX_PROGRAM + 2 * FUZZ_MAX_STEPS) // memory changes one case can make
+
+/* ------------ REFERENCE MODEL -------------- */
+// A second 8080 written straight from the databook, with plain int arithmetic and no code shared
+// with the interpreter. Each memory write is logged so the memory can be put back after a case
+
+typedef struct ref_cpu {
+	int r[8]; // B, C, D, E, H, L, (M), A, indexed like the register fields of the opcodes
+	int sp, pc;
+	int z, s, p, cy, ac;
+	int inte;
+	uint64_t cycles;
+	uint8_t* mem;
+	int num_writes; // entries in the log, FUZZ_MAX_WRITES + 1 if it overflowed
+	uint16_t write_adr[FUZZ_MAX_WRITES];
+	uint8_t write_old[FUZZ_MAX_WRITES];
+} ref_cpu;
+
+#define R_H 4
+#define R_L 5
+#define R_M 6
+#define R_A 7
+
+static int rd(ref_cpu* cpu, int adr) {
+	return cpu->mem[adr & 0xffff];
+}
+
+static void wr(ref_cpu* cpu, int adr, int v) {
+	adr &= 0xffff;
+	if (cpu->num_writes < FUZZ_MAX_WRITES) {
+		cpu->write_adr[cpu->num_writes] = adr;
+		cpu->write_old[cpu->num_writes] = cpu->mem[adr];
+		cpu->num_writes++;
+	} else {
+		cpu->num_writes = FUZZ_MAX_WRITES + 1;
+	}
+	cpu->mem[adr] = v & 0xff;
+}
+
+static int hl(ref_cpu* cpu) {
+	return (cpu->r[R_H] << 8) | cpu->r[R_L];
+}
+
+// Register n of an opcode's register field, 6 is the memory byte at HL
+static int get_r(ref_cpu* cpu, int n) {
+	return n == R_M ? rd(cpu, hl(cpu)) : cpu->r[n];
+}
+
+static void set_r(ref_cpu* cpu, int n, int v) {
+	if (n == R_M) {
+		wr(cpu, hl(cpu), v);
+	} else {
+		cpu->r[n] = v & 0xff;
+	}
+}
+
+// Register pair rp of an opcode's pair field: BC, DE, HL, SP
+static int get_rp(ref_cpu* cpu, int rp) {
+	return rp == 3 ? cpu->sp : (cpu->r[2*rp] << 8) | cpu->r[2*rp + 1];
+}
+
+static void set_rp(ref_cpu* cpu, int rp, int v) {
+	v &= 0xffff;
+	if (rp == 3) {
+		cpu->sp = v;
+	} else {
+		cpu->r[2*rp] = v >> 8;
+		cpu->r[2*rp + 1] = v & 0xff;
+	}
+}
+
+static void push16(ref_cpu* cpu, int v) {
+	cpu->sp = (cpu->sp - 1) & 0xffff;
+	wr(cpu, cpu->sp, v >> 8);
+	cpu->sp = (cpu->sp - 1) & 0xffff;
+	wr(cpu, cpu->sp, v);
+}
+
+static int pop16(ref_cpu* cpu) {
+	int v = rd(cpu, cpu->sp) | (rd(cpu, cpu->sp + 1) << 8);
+	cpu->sp = (cpu->sp + 2) & 0xffff;
+	return v;
+}
+
+// The flags byte of the PSW: s z 0 ac 0 p 1 cy
+static int ref_flags(ref_cpu* cpu) {
+	return cpu->s << 7 | cpu->z << 6 | cpu->ac << 4 | cpu->p << 2 | 0x02 | cpu->cy;
+}
+
+static void set_ref_flags(ref_cpu* cpu, int f) {
+	cpu->s = (f >> 7) & 1;
+	cpu->z = (f >> 6) & 1;
+	cpu->ac = (f >> 4) & 1;
+	cpu->p = (f >> 2) & 1;
+	cpu->cy = f & 1;
+}
+
+// Sets zero, sign and parity from an 8 bit result, parity by counting the ones
+static void zsp(ref_cpu* cpu, int v) {
+	int ones = 0;
+	for (int i = 0; i < 8; i++) {
+		ones += (v >> i) & 1;
+	}
+	cpu->z = v == 0;
+	cpu->s = v >= 0x80;
+	cpu->p = ones % 2 == 0;
+}
+
+// Condition ccc of a conditional jump, call or return: NZ, Z, NC, C, PO, PE, P, M
+static int condition(ref_cpu* cpu, int ccc) {
+	int bits[4] = {cpu->z, cpu->cy, cpu->p, cpu->s};
+	return ccc & 1 ? bits[ccc >> 1] : !bits[ccc >> 1];
+}
+
+// ADD, ADC, SUB, SBB, ANA, XRA, ORA or CMP v into the accumulator
+static void alu(ref_cpu* cpu, int op, int v) {
+	int a = cpu->r[R_A];
+	int carry = (op == 1 || op == 3) ? cpu->cy : 0;
+	int answer;
+	switch (op) {
+		case 0: case 1: // ADD, ADC
+			answer = a + v + carry;
+			cpu->ac = (a % 16) + (v % 16) + carry > 15;
+			cpu->cy = answer > 255;
+			break;
+		case 2: case 3: case 7: // SUB, SBB, CMP add the complement of v, carry is then the borrow
+			answer = a - v - carry;
+			cpu->ac = (a % 16) + (15 - v % 16) + (1 - carry) > 15;
+			cpu->cy = answer < 0;
+			break;
+		case 4: // ANA, the auxiliary carry is the OR of bit 3 of the operands
+			answer = a & v;
+			cpu->ac = ((a | v) >> 3) & 1;
+			cpu->cy = 0;
+			break;
+		case 5:
+			answer = a ^ v;
+			cpu->ac = cpu->cy = 0;
+			break;
+		default:
+			answer = a | v;
+			cpu->ac = cpu->cy = 0;
+			break;
+	}
+	answer &= 0xff;
+	zsp(cpu, answer);
+	if (op != 7) {
+		cpu->r[R_A] = answer;
+	}
+}
+
+// Executes one instruction, with the cycle counts from the databook
+static void ref_step(ref_cpu* cpu) {
+	int pc = cpu->pc;
+	int op = rd(cpu, pc);
+	int d8 = rd(cpu, pc + 1);
+	int d16 = d8 | (rd(cpu, pc + 2) << 8);
+	int ddd = (op >> 3) & 7, sss = op & 7, rp = (op >> 4) & 3;
+	int a = cpu->r[R_A];
+	int cycles = 4, size = 1, v;
+
+	if (op >= 0x40 && op < 0x80) { // MOV, 0x76 (HLT) never reaches here
+		cycles = (ddd == R_M || sss == R_M) ? 7 : 5;
+		set_r(cpu, ddd, get_r(cpu, sss));
+	} else if (op >= 0x80 && op < 0xc0) {
+		cycles = sss == R_M ? 7 : 4;
+		alu(cpu, ddd, get_r(cpu, sss));
+	} else if (op < 0x40) {
+		switch (op & 0x0f) {
+			case 0x01: size = 3; cycles = 10; set_rp(cpu, rp, d16); break; // LXI
+			case 0x03: cycles = 5; set_rp(cpu, rp, get_rp(cpu, rp) + 1); break; // INX
+			case 0x09: cycles = 10; v = hl(cpu) + get_rp(cpu, rp); cpu->cy = v > 0xffff; set_rp(cpu, 2, v); break; // DAD
+			case 0x0b: cycles = 5; set_rp(cpu, rp, get_rp(cpu, rp) - 1); break; // DCX
+		}
+		switch (op & 0x07) {
+			case 0x04: // INR, the auxiliary carry is the carry out of bit 3
+				cycles = ddd == R_M ? 10 : 5;
+				v = (get_r(cpu, ddd) + 1) & 0xff;
+				cpu->ac = v % 16 == 0;
+				zsp(cpu, v);
+				set_r(cpu, ddd, v);
+				break;
+			case 0x05: // DCR adds 0xff, so there is a carry out of bit 3 unless the low digit was 0
+				cycles = ddd == R_M ? 10 : 5;
+				v = get_r(cpu, ddd);
+				cpu->ac = v % 16 != 0;
+				v = (v + 255) & 0xff;
+				zsp(cpu, v);
+				set_r(cpu, ddd, v);
+				break;
+			case 0x06: // MVI
+				size = 2;
+				cycles = ddd == R_M ? 10 : 7;
+				set_r(cpu, ddd, d8);
+				break;
+		}
+		switch (op) {
+			case 0x02: case 0x12: cycles = 7; wr(cpu, get_rp(cpu, rp), a); break; // STAX
+			case 0x0a: case 0x1a: cycles = 7; cpu->r[R_A] = rd(cpu, get_rp(cpu, rp)); break; // LDAX
+			case 0x22: size = 3; cycles = 16; wr(cpu, d16, cpu->r[R_L]); wr(cpu, d16 + 1, cpu->r[R_H]); break; // SHLD
+			case 0x2a: size = 3; cycles = 16; cpu->r[R_L] = rd(cpu, d16); cpu->r[R_H] = rd(cpu, d16 + 1); break; // LHLD
+			case 0x32: size = 3; cycles = 13; wr(cpu, d16, a); break; // STA
+			case 0x3a: size = 3; cycles = 13; cpu->r[R_A] = rd(cpu, d16); break; // LDA
+			case 0x07: cpu->cy = a >> 7; cpu->r[R_A] = ((a << 1) | cpu->cy) & 0xff; break; // RLC
+			case 0x0f: cpu->cy = a & 1; cpu->r[R_A] = (a >> 1) | (cpu->cy << 7); break; // RRC
+			case 0x17: cpu->r[R_A] = ((a << 1) | cpu->cy) & 0xff; cpu->cy = a >> 7; break; // RAL
+			case 0x1f: cpu->r[R_A] = (a >> 1) | (cpu->cy << 7); cpu->cy = a & 1; break; // RAR
+			case 0x27: { // DAA adds 6 to each digit that is over 9 or carried out
+				int add = 0, carry = cpu->cy;
+				if (a % 16 > 9 || cpu->ac) {
+					add += 0x06;
+				}
+				if (a > 0x99 || cpu->cy) {
+					add += 0x60;
+					carry = 1;
+				}
+				cpu->ac = (a % 16) + (add % 16) > 15;
+				cpu->r[R_A] = (a + add) & 0xff;
+				zsp(cpu, cpu->r[R_A]);
+				cpu->cy = carry;
+				break;
+			}
+			case 0x2f: cpu->r[R_A] = a ^ 0xff; break; // CMA
+			case 0x37: cpu->cy = 1; break; // STC
+			case 0x3f: cpu->cy = !cpu->cy; break; // CMC
+		}
+	} else {
+		int next = (pc + op_table[op].size) & 0xffff; // return address of calls
+		switch (op & 0x07) {
+			case 0x00: // Rcc
+				cycles = 5;
+				if (condition(cpu, ddd)) {
+					cycles = 11;
+					cpu->pc = pop16(cpu);
+					size = 0;
+				}
+				break;
+			case 0x02: // Jcc
+				cycles = 10;
+				size = 3;
+				if (condition(cpu, ddd)) {
+					cpu->pc = d16;
+					size = 0;
+				}
+				break;
+			case 0x04: // Ccc
+				cycles = 11;
+				size = 3;
+				if (condition(cpu, ddd)) {
+					cycles = 17;
+					push16(cpu, next);
+					cpu->pc = d16;
+					size = 0;
+				}
+				break;
+			case 0x06: // ADI ... CPI
+				cycles = 7;
+				size = 2;
+				alu(cpu, ddd, d8);
+				break;
+			case 0x07: // RST
+				cycles = 11;
+				push16(cpu, next);
+				cpu->pc = op & 0x38;
+				size = 0;
+				break;
+		}
+		switch (op) {
+			case 0xc1: case 0xd1: case 0xe1: cycles = 10; set_rp(cpu, rp, pop16(cpu)); break; // POP
+			case 0xf1: cycles = 10; v = pop16(cpu); set_ref_flags(cpu, v & 0xff); cpu->r[R_A] = v >> 8; break; // POP PSW
+			case 0xc5: case 0xd5: case 0xe5: cycles = 11; push16(cpu, get_rp(cpu, rp)); break; // PUSH
+			case 0xf5: cycles = 11; push16(cpu, (a << 8) | ref_flags(cpu)); break; // PUSH PSW
+			case 0xc3: cycles = 10; cpu->pc = d16; size = 0; break; // JMP
+			case 0xc9: cycles = 10; cpu->pc = pop16(cpu); size = 0; break; // RET
+			case 0xcd: cycles = 17; push16(cpu, next); cpu->pc = d16; size = 0; break; // CALL
+			case 0xe3: // XTHL
+				cycles = 18;
+				v = rd(cpu, cpu->sp) | (rd(cpu, cpu->sp + 1) << 8);
+				wr(cpu, cpu->sp, cpu->r[R_L]);
+				wr(cpu, cpu->sp + 1, cpu->r[R_H]);
+				set_rp(cpu, 2, v);
+				break;
+			case 0xe9: cycles = 5; cpu->pc = hl(cpu); size = 0; break; // PCHL
+			case 0xeb: v = hl(cpu); set_rp(cpu, 2, get_rp(cpu, 1)); set_rp(cpu, 1, v); break; // XCHG
+			case 0xf9: cycles = 5; cpu->sp = hl(cpu); break; // SPHL
+			case 0xf3: cpu->inte = 0; break; // DI
+			case 0xfb: cpu->inte = 1; break; // EI
+		}
+	}
+	cpu->pc = (cpu->pc + size) & 0xffff;
+	cpu->cycles += cycles;
+}
+
+/* ------------- CASES --------------- */
+
+typedef struct fuzz_case { // a starting state and the code placed at its PC
+	uint8_t regs[7]; // A, B, C, D, E, H, L
+	uint16_t sp, pc;
+	uint8_t flags; // condition bits as in the PSW
+	uint8_t inte;
+	uint8_t program[FUZZ_MAX_PROGRAM + 2]; // padded for an operand cut off at the end
+	int len;
+	int steps;
+} fuzz_case;
+
+// Opcodes that end a case: HLT stops the machine, IN and OUT need devices, and the undocumented
+// opcodes the interpreter treats as NOP are aliases of JMP, RET and CALL on a real 8080
+static int ends_case(int op) {
+	return op == 0x76 || op == 0xd3 || op == 0xdb || op == 0xcb || op == 0xd9 || op == 0xdd || op == 0xed || op == 0xfd;
+}
+
+static uint64_t splitmix(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// xorshift64*, each worker has its own generator state
+static uint64_t next_random(uint64_t* s) {
+	*s ^= *s >> 12;
+	*s ^= *s << 25;
+	*s ^= *s >> 27;
+	return *s * 0x2545f4914f6cdd1dULL;
+}
+
+// Generates case n of the run with the given seed
+static void generate(fuzz_case* c, uint64_t seed, long n) {
+	uint64_t s = splitmix(seed ^ splitmix(n)) | 1;
+	uint64_t r = next_random(&s);
+	memset(c, 0, sizeof(*c));
+	for (int i = 0; i < 7; i++) {
+		c->regs[i] = r >> (8 * i);
+	}
+	r = next_random(&s);
+	c->pc = r;
+	c->sp = r >> 16;
+	c->flags = ((r >> 32) & 0xd5) | 0x02;
+	c->inte = (r >> 40) & 1;
+	c->steps = 1 + (r >> 41) % FUZZ_MAX_STEPS;
+	switch ((r >> 48) & 7) { // sometimes point HL or SP at the code, to exercise self-modifying code
+		case 0: c->regs[5] = c->pc >> 8; c->regs[6] = (c->pc + ((r >> 56) % FUZZ_MAX_PROGRAM)) & 0xff; break;
+		case 1: c->sp = c->pc + FUZZ_MAX_PROGRAM; break;
+	}
+	while (c->len < FUZZ_MAX_PROGRAM) {
+		r = next_random(&s);
+		int op = r & 0xff;
+		if (ends_case(op)) {
+			continue;
+		}
+		int size = op_table[op].size;
+		if (c->len + size > FUZZ_MAX_PROGRAM) {
+			break;
+		}
+		c->program[c->len] = op;
+		for (int i = 1; i < size; i++) {
+			c->program[c->len + i] = r >> (8 * i);
+		}
+		if (op_table[op].operand == OPND_ADDR && (r >> 24) & 1) { // jump or call back into the code
+			uint16_t target = c->pc + (r >> 32) % FUZZ_MAX_PROGRAM;
+			c->program[c->len + 1] = target & 0xff;
+			c->program[c->len + 2] = target >> 8;
+		}
+		c->len += size;
+	}
+}
+
+/* ------------- WORKERS --------------- */
+
+typedef struct fuzz_job { // shared between the worker threads
+	long cases;
+	int threads;
+	uint64_t seed;
+	FILE* out;
+	pthread_mutex_t lock;
+	uint8_t reported[256]; // opcodes a failure has been printed for
+	long failures;
+	uint64_t instructions;
+} fuzz_job;
+
+typedef struct fuzz_worker { // the machines of one thread, allocated once and reused for every case
+	fuzz_job* job;
+	long first, end; // cases to run
+	hw_state emu;
+	ref_cpu ref;
+	uint8_t* pristine; // memory both machines start each case with
+	int executed; // instructions run by the last case
+	int last_op; // opcode of the last instruction it ran
+	uint16_t ran_pc[FUZZ_MAX_STEPS]; // address and bytes of each instruction it ran
+	uint8_t ran_op[FUZZ_MAX_STEPS][3];
+	uint64_t instructions;
+} fuzz_worker;
+
+// Places c in both machines. Writing the code goes through the reference model's log, so putting
+// its memory back also removes the code
+static void load(fuzz_worker* w, const fuzz_case* c) {
+	ref_cpu* ref = &w->ref;
+	hw_state* emu = &w->emu;
+	ref->num_writes = 0;
+	for (int i = 0; i < c->len; i++) {
+		wr(ref, c->pc + i, c->program[i]);
+		emu->memory[(uint16_t) (c->pc + i)] = c->program[i];
+	}
+	for (int i = 0; i < 7; i++) {
+		ref->r[i == 0 ? R_A : i - 1] = c->regs[i];
+	}
+	ref->sp = c->sp;
+	ref->pc = c->pc;
+	set_ref_flags(ref, c->flags);
+	ref->inte = c->inte;
+	ref->cycles = 0;
+
+	emu->b = c->regs[1];
+	emu->c = c->regs[2];
+	emu->d = c->regs[3];
+	emu->e = c->regs[4];
+	emu->h = c->regs[5];
+	emu->l = c->regs[6];
+	set_psw(emu, (c->regs[0] << 8) | c->flags);
+	emu->sp = c->sp;
+	emu->pc = c->pc;
+	emu->interrupt_enabled = c->inte;
+	emu->cycles = 0;
+	memset(&emu->counters, 0, sizeof(emu->counters));
+}
+
+// Puts both memories back as they were before load, using the log if it is complete
+static void restore(fuzz_worker* w, int full) {
+	ref_cpu* ref = &w->ref;
+	if (full || ref->num_writes > FUZZ_MAX_WRITES) {
+		memcpy(ref->mem, w->pristine, MEMORY_SIZE);
+		memcpy(w->emu.memory, w->pristine, MEMORY_SIZE);
+	} else {
+		for (int i = ref->num_writes - 1; i >= 0; i--) {
+			ref->mem[ref->write_adr[i]] = ref->write_old[i];
+			w->emu.memory[ref->write_adr[i]] = ref->write_old[i];
+		}
+	}
+	ref->num_writes = 0;
+}
+
+// Runs c on both machines, stopping early at an opcode that ends a case
+static void run(fuzz_worker* w, const fuzz_case* c) {
+	load(w, c);
+	w->executed = 0;
+	for (int i = 0; i < c->steps; i++) {
+		int op = w->ref.mem[w->ref.pc];
+		if (ends_case(op) || ends_case(w->emu.memory[w->emu.pc])) {
+			break;
+		}
+		w->last_op = op;
+		w->ran_pc[i] = w->ref.pc;
+		memcpy(w->ran_op[i], (uint8_t[]) {op, w->ref.mem[(uint16_t) (w->ref.pc + 1)], w->ref.mem[(uint16_t) (w->ref.pc + 2)]}, 3);
+		ref_step(&w->ref);
+		emulate(&w->emu);
+		w->executed++;
+	}
+}
+
+// Describes the first difference between the machines in buf, with memory compared in full or only
+// where the reference model wrote. Returns 0 if there is none
+static int difference(fuzz_worker* w, int full, char* buf, size_t len) {
+	hw_state* emu = &w->emu;
+	ref_cpu* ref = &w->ref;
+	static const char* names[] = {"A", "B", "C", "D", "E", "H", "L", "SP", "PC", "flags", "interrupt enable", "cycles", "instructions"};
+	uint64_t want[] = {ref->r[R_A], ref->r[0], ref->r[1], ref->r[2], ref->r[3], ref->r[R_H], ref->r[R_L], ref->sp, ref->pc,
+		ref_flags(ref), ref->inte, ref->cycles, w->executed};
+	uint64_t got[] = {emu->a, emu->b, emu->c, emu->d, emu->e, emu->h, emu->l, emu->sp, emu->pc,
+		get_psw(emu) & 0xff, emu->interrupt_enabled, emu->cycles, emu->counters.instructions};
+	for (int i = 0; i < 13; i++) {
+		if (want[i] != got[i]) {
+			if (buf != NULL) {
+				snprintf(buf, len, "%s expected %llX got %llX", names[i], (unsigned long long) want[i], (unsigned long long) got[i]);
+			}
+			return 1;
+		}
+	}
+	int num = ref->num_writes > FUZZ_MAX_WRITES ? FUZZ_MAX_WRITES : ref->num_writes;
+	for (int i = 0; i < num; i++) {
+		uint16_t adr = ref->write_adr[i];
+		if (emu->memory[adr] != ref->mem[adr]) {
+			full = 1;
+			break;
+		}
+	}
+	if (full && memcmp(emu->memory, ref->mem, MEMORY_SIZE) != 0) {
+		int adr = 0;
+		while (emu->memory[adr] == ref->mem[adr]) {
+			adr++;
+		}
+		if (buf != NULL) {
+			snprintf(buf, len, "memory %04X expected %02X got %02X", adr, ref->mem[adr], emu->memory[adr]);
+		}
+		return 1;
+	}
+	return 0;
+}
+
+// Returns the number of instructions after which c first fails, comparing all of memory after each
+// one, or 0 if it never does
+static int failing_step(fuzz_worker* w, const fuzz_case* c) {
+	fuzz_case t = *c;
+	for (t.steps = 1; t.steps <= c->steps; t.steps++) {
+		run(w, &t);
+		int failed = difference(w, 1, NULL, 0);
+		restore(w, failed); // the log is enough while the memories match
+		if (failed) {
+			return t.steps;
+		}
+		if (w->executed < t.steps) {
+			break; // stopped at an opcode that ends the case
+		}
+	}
+	return 0;
+}
+
+// Keeps t in place of c if it still fails in opcode op, with its steps cut to the first failing
+// instruction
+static int try_smaller(fuzz_worker* w, fuzz_case* c, fuzz_case* t, int op) {
+	t->steps = FUZZ_MAX_STEPS;
+	int steps = failing_step(w, t);
+	if (steps == 0 || w->last_op != op) {
+		return 0;
+	}
+	t->steps = steps;
+	*c = *t;
+	return 1;
+}
+
+// Shrinks a case that fails in opcode op: instructions replaced by NOPs, code dropped from both
+// ends and registers zeroed, for as long as it still fails the same way
+static void minimise(fuzz_worker* w, fuzz_case* c, int op) {
+	int changed = 1;
+	while (changed) {
+		changed = 0;
+		for (int i = 0; i < c->len; i += op_table[c->program[i]].size) {
+			if (c->program[i] == 0) {
+				continue;
+			}
+			fuzz_case t = *c;
+			int size = op_table[c->program[i]].size;
+			memset(&t.program[i], 0, size < c->len - i ? size : c->len - i);
+			changed |= try_smaller(w, c, &t, op);
+		}
+		while (c->len > 0) {
+			fuzz_case t = *c;
+			t.len--;
+			t.program[t.len] = 0;
+			if (!try_smaller(w, c, &t, op)) {
+				break;
+			}
+			changed = 1;
+		}
+		while (c->len > 0 && c->program[0] == 0) { // start after leading NOPs, code stays where it was
+			fuzz_case t = *c;
+			t.pc++;
+			t.len--;
+			memmove(t.program, t.program + 1, t.len);
+			t.program[t.len] = 0;
+			if (!try_smaller(w, c, &t, op)) {
+				break;
+			}
+			changed = 1;
+		}
+		for (int i = 0; i < 7; i++) {
+			if (c->regs[i] != 0) {
+				fuzz_case t = *c;
+				t.regs[i] = 0;
+				changed |= try_smaller(w, c, &t, op);
+			}
+		}
+		if (c->flags != 0x02 || c->inte) {
+			fuzz_case t = *c;
+			t.flags = 0x02;
+			t.inte = 0;
+			changed |= try_smaller(w, c, &t, op);
+		}
+	}
+}
+
+static void print_regs(FILE* out, const char* label, int a, int b, int c, int d, int e, int h, int l, int sp, int pc, int flags, int inte) {
+	fprintf(out, "  %s A=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%04X PC=%04X F=%02X EI=%d\n",
+		label, a, b, c, d, e, h, l, sp, pc, flags, inte);
+}
+
+// Prints a minimised case and how the machines differ after it
+static void report(fuzz_worker* w, const fuzz_case* c, long n, FILE* out) {
+	run(w, c);
+	char diff[80];
+	difference(w, 1, diff, sizeof(diff));
+	fprintf(out, "%02X %s: %s after %d instructions (case %ld)\n", w->last_op, op_table[w->last_op].name, diff, c->steps, n);
+	print_regs(out, "before  ", c->regs[0], c->regs[1], c->regs[2], c->regs[3], c->regs[4], c->regs[5], c->regs[6],
+		c->sp, c->pc, c->flags, c->inte);
+	fprintf(out, "  code     %04X:", c->pc);
+	for (int i = 0; i < c->len; i++) {
+		fprintf(out, " %02X", c->program[i]);
+	}
+	fprintf(out, "%s\n", c->len ? "" : " (none, runs what was in memory)");
+	for (int i = 0; i < w->executed; i++) {
+		int nops = 0;
+		while (i + nops < w->executed && w->ran_op[i + nops][0] == 0x00) {
+			nops++;
+		}
+		if (nops > 1) { // runs of NOPs left by the minimiser
+			fprintf(out, "    %04X NOP x%d\n", w->ran_pc[i], nops);
+			i += nops - 1;
+			continue;
+		}
+		char text[32];
+		format_op(text, sizeof(text), w->ran_op[i], 0);
+		fprintf(out, "    %04X %s\n", w->ran_pc[i], text);
+	}
+	ref_cpu* ref = &w->ref;
+	hw_state* emu = &w->emu;
+	print_regs(out, "expected", ref->r[R_A], ref->r[0], ref->r[1], ref->r[2], ref->r[3], ref->r[R_H], ref->r[R_L],
+		ref->sp, ref->pc, ref_flags(ref), ref->inte);
+	print_regs(out, "got     ", emu->a, emu->b, emu->c, emu->d, emu->e, emu->h, emu->l,
+		emu->sp, emu->pc, get_psw(emu) & 0xff, emu->interrupt_enabled);
+	restore(w, 1);
+}
+
+// Counts the failing case n, and minimises and prints it if it is the first to fail in its opcode
+static void failed(fuzz_worker* w, long n) {
+	fuzz_case c;
+	generate(&c, w->job->seed, n);
+	c.steps = failing_step(w, &c);
+	fuzz_case t = c;
+	run(w, &t); // for the opcode of the instruction that goes wrong
+	restore(w, 1);
+	fuzz_job* job = w->job;
+	pthread_mutex_lock(&job->lock);
+	job->failures++;
+	int first = !job->reported[w->last_op];
+	job->reported[w->last_op] = 1;
+	pthread_mutex_unlock(&job->lock);
+	if (first) {
+		minimise(w, &c, w->last_op);
+		pthread_mutex_lock(&job->lock);
+		report(w, &c, n, job->out);
+		pthread_mutex_unlock(&job->lock);
+	}
+}
+
+static void* fuzz_worker_run(void* arg) {
+	fuzz_worker* w = arg;
+	fuzz_case c;
+	for (long first = w->first; first < w->end; first += FUZZ_BATCH) {
+		long last = first + FUZZ_BATCH < w->end ? first + FUZZ_BATCH : w->end;
+		for (long n = first; n < last; n++) {
+			generate(&c, w->job->seed, n);
+			run(w, &c);
+			w->instructions += w->executed;
+			if (difference(w, 0, NULL, 0)) {
+				restore(w, 1);
+				failed(w, n);
+			} else {
+				restore(w, 0);
+			}
+		}
+		// the log only covers the reference model's writes, a stray write by the interpreter is
+		// found here and the batch is run again one case at a time to find it
+		if (memcmp(w->emu.memory, w->ref.mem, MEMORY_SIZE) != 0) {
+			restore(w, 1);
+			for (long n = first; n < last; n++) {
+				generate(&c, w->job->seed, n);
+				run(w, &c);
+				int stray = !difference(w, 0, NULL, 0) && difference(w, 1, NULL, 0);
+				restore(w, 1);
+				if (stray) {
+					failed(w, n);
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+long run_fuzzer(long cases, int threads, uint64_t seed, FILE* out) {
+	if (threads < 1) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	fuzz_job job = {.cases = cases, .threads = threads, .seed = seed, .out = out};
+	pthread_mutex_init(&job.lock, NULL);
+	fuzz_worker* workers = calloc(threads, sizeof(fuzz_worker));
+	pthread_t* ids = malloc(threads * sizeof(pthread_t));
+
+	// every worker gets the same random background memory, so a case runs the same on any of them
+	uint64_t s = splitmix(seed) | 1;
+	uint8_t* pristine = malloc(MEMORY_SIZE);
+	for (int i = 0; i < MEMORY_SIZE; i++) {
+		pristine[i] = next_random(&s) >> 56;
+	}
+	for (int t = 0; t < threads; t++) {
+		fuzz_worker* w = &workers[t];
+		w->job = &job;
+		w->first = cases * t / threads;
+		w->end = cases * (t + 1) / threads;
+		w->pristine = pristine;
+		w->emu.memory = malloc(MEMORY_SIZE);
+		w->ref.mem = malloc(MEMORY_SIZE);
+		restore(w, 1);
+	}
+
+	double start = now();
+	int started = 0;
+	for (; started < threads; started++) {
+		if (pthread_create(&ids[started], NULL, fuzz_worker_run, &workers[started]) != 0) {
+			break;
+		}
+	}
+	for (int t = started; t < threads; t++) {
+		fuzz_worker_run(&workers[t]); // no more threads available, do the work here
+	}
+	for (int t = 0; t < started; t++) {
+		pthread_join(ids[t], NULL);
+	}
+	double seconds = now() - start;
+
+	for (int t = 0; t < threads; t++) {
+		job.instructions += workers[t].instructions;
+		free(workers[t].emu.memory);
+		free(workers[t].ref.mem);
+	}
+	fprintf(out, "fuzz: %ld cases (seed %llu), %llu instructions in %.2f s on %d threads (%.2f M cases/s), %ld failing\n",
+		cases, (unsigned long long) seed, (unsigned long long) job.instructions, seconds, threads,
+		seconds > 0 ? cases / seconds / 1e6 : 0, job.failures);
+	free(pristine);
+	free(workers);
+	free(ids);
+	pthread_mutex_destroy(&job.lock);
+	return job.failures;
+}
@@ -0,0 +1,18 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+#include <stdio.h>
+#include <stdint.h>
+
+#define FUZZ_MAX_PROGRAM 48 // bytes of generated code per case
+#define FUZZ_MAX_STEPS 24 // instructions executed per case
+#define FUZZ_BATCH 64 // cases between full comparisons of memory
+
+// Runs cases random instruction sequences from random machine states through emulate and through
+// a simple reference model of the 8080, split over threads (0 for one per core), and compares the
+// registers, condition bits, interrupt enable, cycles and all of memory afterwards. Each case is
+// generated from seed and its number alone, so a run can be repeated exactly. Every failing case
+// is minimised, and the first one for each opcode is printed to out with its program and the first
+// difference. Returns the number of failing cases
+long run_fuzzer(long cases, int threads, uint64_t seed, FILE* out);
+
+#endif
@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "gdbstub.h"
+
+#define UNIX_PREFIX "unix:"
+#define GDB_POLL_STEPS 0x10000 // instructions between checks for an interrupt from the debugger
+#define GDB_NUM_REGS 6 // AF, BC, DE, HL, SP, PC
+
+#define GDB_SIGINT 2
+#define GDB_SIGTRAP 5
+
+// What the debugger asked for in a packet
+#define ACTION_REPLY 0 // send the reply and wait for the next packet
+#define ACTION_CONTINUE 1
+#define ACTION_STEP 2
+#define ACTION_DETACH 3
+#define ACTION_KILL 4
+
+/* ------------ CONNECTION -------------- */
+
+// Creates a listening socket for a TCP port, host:port or unix:PATH, returns -1 on error
+static int listen_on(const char* address) {
+	int fd;
+	if (strncmp(address, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+		struct sockaddr_un addr = {.sun_family = AF_UNIX};
+		strncpy(addr.sun_path, address + strlen(UNIX_PREFIX), sizeof(addr.sun_path) - 1);
+		unlink(addr.sun_path); // left behind by an earlier run
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr*) &addr, sizeof(addr)) != 0) {
+			goto fail;
+		}
+	} else {
+		char host[256] = "127.0.0.1"; // only local debuggers unless a host is given
+		const char* port = strrchr(address, ':');
+		if (port != NULL) {
+			snprintf(host, sizeof(host), "%.*s", (int) (port - address), address);
+			port++;
+		} else {
+			port = address;
+		}
+		struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+		struct addrinfo* res;
+		if (getaddrinfo(host, port, &hints, &res) != 0) {
+			return -1;
+		}
+		fd = socket(res->ai_family, res->ai_socktype, 0);
+		int one = 1;
+		if (fd >= 0) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		}
+		int bound = fd >= 0 && bind(fd, res->ai_addr, res->ai_addrlen) == 0;
+		freeaddrinfo(res);
+		if (!bound) {
+			goto fail;
+		}
+	}
+	if (listen(fd, 1) != 0) {
+		goto fail;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK); // polling must never wait for a debugger
+	return fd;
+fail:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+int gdb_start(gdb_stub* stub, const char* address, int frames) {
+	memset(stub, 0, sizeof(*stub));
+	stub->fd = -1;
+	stub->frames = frames;
+	stub->listen_fd = listen_on(address);
+	return stub->listen_fd >= 0;
+}
+
+void gdb_stop(gdb_stub* stub) {
+	if (stub->fd >= 0) {
+		close(stub->fd);
+		stub->fd = -1;
+	}
+	if (stub->listen_fd >= 0) {
+		close(stub->listen_fd);
+		stub->listen_fd = -1;
+	}
+}
+
+/* ------------ PACKETS -------------- */
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// Returns the value of hex digit c, or -1
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+// Parses hex digits at *p, leaving *p after them
+static unsigned long parse_hex(const char** p) {
+	unsigned long v = 0;
+	while (hex_value(**p) >= 0) {
+		v = (v << 4) | hex_value(**p);
+		(*p)++;
+	}
+	return v;
+}
+
+// Reads one byte from the debugger, returns -1 if it has gone
+static int read_byte(gdb_stub* stub) {
+	unsigned char c;
+	return recv(stub->fd, &c, 1, 0) == 1 ? c : -1;
+}
+
+static int send_all(gdb_stub* stub, const char* buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = send(stub->fd, buf, len, MSG_NOSIGNAL);
+		if (n <= 0) {
+			return 0;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 1;
+}
+
+// Reads the next $data#checksum packet into stub->packet and acknowledges it, returns 0 if the
+// debugger has gone. Interrupt bytes sent while the machine is already stopped are ignored
+static int get_packet(gdb_stub* stub) {
+	for (;;) {
+		int c;
+		while ((c = read_byte(stub)) != '$') {
+			if (c < 0) {
+				return 0;
+			}
+		}
+		int len = 0;
+		uint8_t sum = 0;
+		while ((c = read_byte(stub)) != '#') {
+			if (c < 0) {
+				return 0;
+			}
+			if (len < GDB_PACKET_SIZE) {
+				stub->packet[len++] = c;
+			}
+			sum += c;
+		}
+		int hi = read_byte(stub), lo = read_byte(stub);
+		if (hi < 0 || lo < 0) {
+			return 0;
+		}
+		stub->packet[len] = '\0';
+		if (hex_value(hi) * 16 + hex_value(lo) == sum) {
+			return send_all(stub, "+", 1);
+		}
+		if (!send_all(stub, "-", 1)) { // corrupted, ask for it again
+			return 0;
+		}
+	}
+}
+
+// Sends data as a packet, resending until the debugger acknowledges it. Returns 0 if it has gone
+static int put_packet(gdb_stub* stub, const char* data) {
+	uint8_t sum = 0;
+	for (const char* p = data; *p; p++) {
+		sum += *p;
+	}
+	char tail[3] = {'#', hex_digits[sum >> 4], hex_digits[sum & 0xf]};
+	for (;;) {
+		if (!send_all(stub, "$", 1) || !send_all(stub, data, strlen(data)) || !send_all(stub, tail, 3)) {
+			return 0;
+		}
+		int c = read_byte(stub);
+		if (c == '+') {
+			return 1;
+		} else if (c < 0) {
+			return 0;
+		}
+	}
+}
+
+/* ------------ MACHINE -------------- */
+
+static uint16_t get_gdb_reg(hw_state* state, int n) {
+	switch (n) {
+		case 0: return get_psw(state);
+		case 1: return (state->b << 8) | state->c;
+		case 2: return (state->d << 8) | state->e;
+		case 3: return (state->h << 8) | state->l;
+		case 4: return state->sp;
+		default: return state->pc;
+	}
+}
+
+static void set_gdb_reg(hw_state* state, int n, uint16_t v) {
+	switch (n) {
+		case 0: set_psw(state, v); break;
+		case 1: state->b = v >> 8; state->c = v & 0xff; break;
+		case 2: state->d = v >> 8; state->e = v & 0xff; break;
+		case 3: state->h = v >> 8; state->l = v & 0xff; break;
+		case 4: state->sp = v; break;
+		case 5: state->pc = v; break;
+	}
+}
+
+// Writes v as four hex digits, low byte first as GDB expects registers
+static char* put_reg(char* p, uint16_t v) {
+	*p++ = hex_digits[(v >> 4) & 0xf];
+	*p++ = hex_digits[v & 0xf];
+	*p++ = hex_digits[(v >> 12) & 0xf];
+	*p++ = hex_digits[(v >> 8) & 0xf];
+	return p;
+}
+
+// Parses a register written low byte first
+static uint16_t parse_reg(const char* p) {
+	return (hex_value(p[0]) << 4) | hex_value(p[1]) | (hex_value(p[2]) << 12) | (hex_value(p[3]) << 8);
+}
+
+static int is_breakpoint(gdb_stub* stub, uint16_t adr) {
+	return (stub->breakpoints[adr >> 3] >> (adr & 7)) & 1;
+}
+
+static void set_breakpoint(gdb_stub* stub, uint16_t adr, int on) {
+	if (is_breakpoint(stub, adr) != on) {
+		stub->breakpoints[adr >> 3] ^= 1 << (adr & 7);
+		stub->num_breakpoints += on ? 1 : -1;
+	}
+}
+
+// Executes one instruction, delivering the frame interrupts at the same points run_frame does
+static void step(gdb_stub* stub, hw_state* state) {
+	uint64_t due = frame_interrupt_due(state);
+	if (emulate(state) == CORE_HALTED && stub->frames) {
+		state->cycles = due; // a halted machine only waits, let its clock run on to the next interrupt
+	}
+	if (stub->frames && state->cycles >= due) {
+		frame_interrupt(state);
+	}
+}
+
+// Returns 1 if the debugger has sent an interrupt (Ctrl-C) or disconnected, without blocking
+static int interrupted(gdb_stub* stub) {
+	struct pollfd pfd = {.fd = stub->fd, .events = POLLIN};
+	while (poll(&pfd, 1, 0) > 0) {
+		int c = read_byte(stub);
+		if (c == 0x03 || c < 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Runs until a breakpoint or an interrupt from the debugger, returns the signal to report
+static int run(gdb_stub* stub, hw_state* state) {
+	step(stub, state); // leave the stopping point first, even if it is a breakpoint
+	if (stub->num_breakpoints == 0) { // nothing to check per instruction
+		for (;;) {
+			for (int i = 0; i < GDB_POLL_STEPS; i++) {
+				step(stub, state);
+			}
+			if (interrupted(stub)) {
+				return GDB_SIGINT;
+			}
+		}
+	}
+	for (uint32_t n = 1;; n++) {
+		if (is_breakpoint(stub, state->pc)) {
+			return GDB_SIGTRAP;
+		}
+		if (n % GDB_POLL_STEPS == 0 && interrupted(stub)) {
+			return GDB_SIGINT;
+		}
+		step(stub, state);
+	}
+}
+
+/* ------------ COMMANDS -------------- */
+
+// Carries out the command in stub->packet, writing any reply to reply. Returns the ACTION to take
+static int handle_packet(gdb_stub* stub, hw_state* state, char* reply) {
+	const char* p = stub->packet + 1;
+	reply[0] = '\0';
+	switch (stub->packet[0]) {
+		case '?': // why the machine stopped
+			strcpy(reply, "S05");
+			break;
+		case 'g': { // read all registers
+			char* out = reply;
+			for (int n = 0; n < GDB_NUM_REGS; n++) {
+				out = put_reg(out, get_gdb_reg(state, n));
+			}
+			*out = '\0';
+			break;
+		}
+		case 'G': // write all registers
+			for (int n = 0; n < GDB_NUM_REGS && strlen(p) >= 4; n++, p += 4) {
+				set_gdb_reg(state, n, parse_reg(p));
+			}
+			strcpy(reply, "OK");
+			break;
+		case 'p': { // read register n
+			int n = parse_hex(&p);
+			if (n < GDB_NUM_REGS) {
+				*put_reg(reply, get_gdb_reg(state, n)) = '\0';
+			} else {
+				strcpy(reply, "E01");
+			}
+			break;
+		}
+		case 'P': { // write register n=value
+			int n = parse_hex(&p);
+			if (n < GDB_NUM_REGS && *p == '=' && strlen(p + 1) >= 4) {
+				set_gdb_reg(state, n, parse_reg(p + 1));
+				strcpy(reply, "OK");
+			} else {
+				strcpy(reply, "E01");
+			}
+			break;
+		}
+		case 'm': { // read len bytes at adr
+			uint16_t adr = parse_hex(&p);
+			p++;
+			unsigned long len = parse_hex(&p);
+			if (len > GDB_PACKET_SIZE / 2) {
+				len = GDB_PACKET_SIZE / 2;
+			}
+			for (unsigned long i = 0; i < len; i++, adr++) {
+				reply[2*i] = hex_digits[state->memory[adr] >> 4];
+				reply[2*i+1] = hex_digits[state->memory[adr] & 0xf];
+			}
+			reply[2*len] = '\0';
+			break;
+		}
+		case 'M': { // write len bytes at adr
+			uint16_t adr = parse_hex(&p);
+			p++;
+			unsigned long len = parse_hex(&p);
+			p++;
+			for (unsigned long i = 0; i < len && hex_value(p[0]) >= 0 && hex_value(p[1]) >= 0; i++, adr++, p += 2) {
+				state->memory[adr] = (hex_value(p[0]) << 4) | hex_value(p[1]);
+			}
+			strcpy(reply, "OK");
+			break;
+		}
+		case 'c': // continue, optionally from an address
+		case 's': // single step
+			if (*p) {
+				state->pc = parse_hex(&p);
+			}
+			return stub->packet[0] == 'c' ? ACTION_CONTINUE : ACTION_STEP;
+		case 'Z': // insert breakpoint type,adr,kind
+		case 'z': { // remove breakpoint
+			if (*p != '0' && *p != '1') {
+				break; // watchpoints are not supported, the empty reply says so
+			}
+			p += 2;
+			set_breakpoint(stub, parse_hex(&p), stub->packet[0] == 'Z');
+			strcpy(reply, "OK");
+			break;
+		}
+		case 'q':
+			if (strncmp(p, "Supported", 9) == 0) {
+				snprintf(reply, GDB_PACKET_SIZE, "PacketSize=%x", GDB_PACKET_SIZE);
+			} else if (strcmp(p, "Attached") == 0) {
+				strcpy(reply, "1"); // attached to a running machine, detaching leaves it running
+			} else if (strcmp(p, "C") == 0) {
+				strcpy(reply, "QC1");
+			}
+			break;
+		case 'H': // select thread, there is only one
+		case 'T':
+			strcpy(reply, "OK");
+			break;
+		case 'D':
+			strcpy(reply, "OK");
+			return ACTION_DETACH;
+		case 'k':
+			return ACTION_KILL;
+	}
+	return ACTION_REPLY;
+}
+
+// Serves the attached debugger until it detaches, kills the program or disconnects
+static void serve(gdb_stub* stub, hw_state* state) {
+	char reply[GDB_PACKET_SIZE + 1];
+	for (;;) {
+		if (!get_packet(stub)) {
+			return;
+		}
+		int action = handle_packet(stub, state, reply);
+		if (action == ACTION_CONTINUE || action == ACTION_STEP) {
+			int sig = GDB_SIGTRAP;
+			if (action == ACTION_CONTINUE) {
+				sig = run(stub, state);
+			} else {
+				step(stub, state);
+			}
+			snprintf(reply, sizeof(reply), "S%02x", sig);
+		} else if (action == ACTION_KILL) {
+			stub->killed = 1;
+			return;
+		}
+		if (!put_packet(stub, reply) || action == ACTION_DETACH) {
+			return;
+		}
+	}
+}
+
+int gdb_poll(gdb_stub* stub, hw_state* state) {
+	if (stub->listen_fd < 0 || stub->killed) {
+		return !stub->killed;
+	}
+	stub->fd = accept(stub->listen_fd, NULL, NULL);
+	if (stub->fd < 0) {
+		return 1; // nobody waiting
+	}
+	int one = 1;
+	setsockopt(stub->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // fails harmlessly on unix sockets
+	serve(stub, state);
+	close(stub->fd);
+	stub->fd = -1;
+	memset(stub->breakpoints, 0, sizeof(stub->breakpoints)); // a detached machine runs at full speed
+	stub->num_breakpoints = 0;
+	return !stub->killed;
+}
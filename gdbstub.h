@@ -0,0 +1,32 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+#include "emulator.h"
+
+#define GDB_PACKET_SIZE 4096 // largest packet accepted or sent, as advertised to the debugger
+
+// Registers are reported as AF, BC, DE, HL, SP and PC, 16 bits each and little endian, the first
+// six registers of the Z80 layout so a Z80-aware GDB can attach. F holds the condition bits in
+// the PUSH PSW layout
+
+typedef struct gdb_stub { // GDB remote serial protocol server for one emulator
+	int listen_fd; // TCP or unix socket waiting for a debugger
+	int fd; // connection to the attached debugger, -1 if none
+	uint8_t breakpoints[MEMORY_SIZE / 8]; // one bit per address
+	int num_breakpoints; // the breakpoint bitmap is skipped entirely while this is 0
+	int frames; // deliver the video frame interrupts while running under the debugger
+	int killed; // the debugger asked for the program to be stopped
+	char packet[GDB_PACKET_SIZE + 1];
+} gdb_stub;
+
+// Listens for a debugger on address, which is a TCP port, host:port, or unix:PATH. frames is set
+// when the machine is driven by run_frame, so interrupts keep arriving while the debugger runs it.
+// Returns 0 if the socket could not be created
+int gdb_start(gdb_stub* stub, const char* address, int frames);
+void gdb_stop(gdb_stub* stub);
+
+// Checks for a waiting debugger without blocking. If one is there the machine is stopped and
+// handed to it until it detaches. Cheap enough to call once per frame. Returns 0 once the
+// debugger has killed the program
+int gdb_poll(gdb_stub* stub, hw_state* state);
+
+#endif
@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hle.h"
+#include "opcodes.h"
+#include "regops.h"
+
+#define INVADERS_HASH 0xa02b653391170906ULL // invaders.rom, the 8K H, G, F, E set
+
+#define CYC(op) op_table[op].cycles
+
+// Adds the cost of the instructions the routine ran natively, then returns like its RET
+static void finish(hw_state* state, uint64_t cycles, uint64_t instructions) {
+	state->cycles += cycles + CYC(0xc9);
+	state->counters.instructions += instructions + 1;
+	ret(state);
+}
+
+// DAD B with BC holding 0x0020, the step to the next row of the screen, preserving BC
+static void dad_row(hw_state* state) {
+	uint8_t b = state->b, c = state->c;
+	state->b = 0x00;
+	state->c = 0x20;
+	dad(state, 'B');
+	state->b = b;
+	state->c = c;
+}
+
+// Number of times a DCR B / JNZ loop runs, B = 0 runs 256 times
+static int loop_count(hw_state* state) {
+	return state->b ? state->b : 256;
+}
+
+/* ------------ SPACE INVADERS -------------- */
+
+// 1439: copy B rows from DE to the screen at HL, one byte per row, rows are 0x20 bytes apart
+//  1439 PUSH B / LDAX D / MOV M,A / INX D / LXI B,#$0020 / DAD B / POP B / DCR B / JNZ $1439 / RET
+static void draw_simple_sprite(hw_state* state) {
+	int n = loop_count(state);
+	uint16_t hl = (state->h << 8) | state->l;
+	uint16_t de = (state->d << 8) | state->e;
+	for (int i = 0; i < n - 1; i++, hl += 0x20, de++) {
+		mem_write(state, hl, mem_read(state, de));
+	}
+	// the last row through the instruction helpers, for the condition bits and the stack contents
+	state->h = hl >> 8;
+	state->l = hl & 0xff;
+	state->b = 1;
+	mem_write(state, state->sp - 1, state->b); // PUSH B leaves BC below the stack
+	mem_write(state, state->sp - 2, state->c);
+	state->a = mem_read(state, de++);
+	mem_write(state, hl, state->a);
+	state->d = de >> 8;
+	state->e = de & 0xff;
+	dad_row(state);
+	dcr(state, 'B');
+	finish(state, (uint64_t) n * (CYC(0xc5) + CYC(0x1a) + CYC(0x77) + CYC(0x13) + CYC(0x01) + CYC(0x09) + CYC(0xc1) + CYC(0x05) + CYC(0xc2)), n * 9);
+}
+
+// 14CB: clear B rows of a one byte wide sprite at HL
+//  14CB XRA A / 14CC PUSH B / MOV M,A / LXI B,#$0020 / DAD B / POP B / DCR B / JNZ $14CC / RET
+static void clear_small_sprite(hw_state* state) {
+	int n = loop_count(state);
+	alu_xor(state, state->a);
+	uint16_t hl = (state->h << 8) | state->l;
+	for (int i = 0; i < n - 1; i++, hl += 0x20) {
+		mem_write(state, hl, 0);
+	}
+	state->h = hl >> 8;
+	state->l = hl & 0xff;
+	state->b = 1;
+	mem_write(state, state->sp - 1, state->b);
+	mem_write(state, state->sp - 2, state->c);
+	mem_write(state, hl, 0);
+	dad_row(state);
+	dcr(state, 'B');
+	finish(state, CYC(0xaf) + (uint64_t) n * (CYC(0xc5) + CYC(0x77) + CYC(0x01) + CYC(0x09) + CYC(0xc1) + CYC(0x05) + CYC(0xc2)), 1 + n * 7);
+}
+
+// 1A32: copy B bytes from DE to HL
+//  1A32 LDAX D / MOV M,A / INX H / INX D / DCR B / JNZ $1A32 / RET
+static void block_copy(hw_state* state) {
+	int n = loop_count(state);
+	uint16_t hl = (state->h << 8) | state->l;
+	uint16_t de = (state->d << 8) | state->e;
+	for (int i = 0; i < n; i++, hl++, de++) {
+		state->a = mem_read(state, de);
+		mem_write(state, hl, state->a);
+	}
+	state->h = hl >> 8;
+	state->l = hl & 0xff;
+	state->d = de >> 8;
+	state->e = de & 0xff;
+	state->b = 1;
+	dcr(state, 'B');
+	finish(state, (uint64_t) n * (CYC(0x1a) + CYC(0x77) + CYC(0x23) + CYC(0x13) + CYC(0x05) + CYC(0xc2)), n * 6);
+}
+
+// 1A5C: clear the screen, 2400 up to 3FFF
+//  1A5C LXI H,#$2400 / 1A5F MVI M,#$00 / INX H / MOV A,H / CPI #$40 / JNZ $1A5F / RET
+static void clear_screen(hw_state* state) {
+	int n = 0x4000 - 0x2400;
+	for (uint16_t adr = 0x2400; adr < 0x4000; adr++) {
+		mem_write(state, adr, 0);
+	}
+	state->h = 0x40;
+	state->l = 0x00;
+	state->a = 0x40;
+	alu_sub(state, 0x40, 0); // the final CPI
+	finish(state, CYC(0x21) + (uint64_t) n * (CYC(0x36) + CYC(0x23) + CYC(0x7c) + CYC(0xfe) + CYC(0xc2)), 1 + n * 5);
+}
+
+// The shifted sprite routines around 1400 read the port 2/4 shift register, which is not
+// emulated yet, so they are left to the guest code
+static const hle_hook known_hooks[] = {
+	{"DrawSimpleSprite", INVADERS_HASH, 0x1439, draw_simple_sprite},
+	{"ClearSmallSprite", INVADERS_HASH, 0x14cb, clear_small_sprite},
+	{"BlockCopy", INVADERS_HASH, 0x1a32, block_copy},
+	{"ClearScreen", INVADERS_HASH, 0x1a5c, clear_screen},
+};
+
+int hle_init(hle_set* set, hw_state* state, uint64_t rom_hash, int verify, FILE* out) {
+	memset(set, 0, sizeof(*set));
+	set->verify = verify;
+	set->out = out;
+	for (size_t i = 0; i < sizeof(known_hooks) / sizeof(known_hooks[0]) && set->num_hooks < HLE_MAX; i++) {
+		if (known_hooks[i].rom_hash == rom_hash) {
+			set->hooks[set->num_hooks++] = &known_hooks[i];
+			set->hooked[known_hooks[i].adr >> 3] |= 1 << (known_hooks[i].adr & 7);
+		}
+	}
+	if (verify && set->num_hooks) {
+		set->scratch = malloc(MEMORY_SIZE);
+		if (set->scratch == NULL) {
+			set->num_hooks = 0; // no way to verify, so install nothing rather than run unchecked
+		}
+	}
+	state->hle = set->num_hooks ? set : NULL; // calls pay nothing for a ROM without hooks
+	return set->num_hooks;
+}
+
+void hle_free(hle_set* set, hw_state* state) {
+	free(set->scratch);
+	set->scratch = NULL;
+	state->hle = NULL;
+}
+
+// Reports the first difference between the native and guest runs of hook, returns 1 if there is one
+static int compare(hle_set* set, const hle_hook* hook, const hw_state* native, const hw_state* guest) {
+	static const char* names[] = {"A", "B", "C", "D", "E", "H", "L", "SP", "PC", "flags", "cycles", "instructions"};
+	uint64_t n[] = {native->a, native->b, native->c, native->d, native->e, native->h, native->l, native->sp, native->pc,
+		native->cc.z | native->cc.s << 1 | native->cc.p << 2 | native->cc.cy << 3 | native->cc.ac << 4,
+		native->cycles, native->counters.instructions};
+	uint64_t g[] = {guest->a, guest->b, guest->c, guest->d, guest->e, guest->h, guest->l, guest->sp, guest->pc,
+		guest->cc.z | guest->cc.s << 1 | guest->cc.p << 2 | guest->cc.cy << 3 | guest->cc.ac << 4,
+		guest->cycles, guest->counters.instructions};
+	for (int i = 0; i < 12; i++) {
+		if (n[i] != g[i]) {
+			fprintf(set->out, "hle %s (%04X): %s native %llX guest %llX\n", hook->name, hook->adr, names[i],
+				(unsigned long long) n[i], (unsigned long long) g[i]);
+			return 1;
+		}
+	}
+	for (int adr = 0; adr < MEMORY_SIZE; adr++) {
+		if (native->memory[adr] != guest->memory[adr]) {
+			fprintf(set->out, "hle %s (%04X): memory %04X native %02X guest %02X\n", hook->name, hook->adr, adr,
+				native->memory[adr], guest->memory[adr]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Runs hook natively on a copy of the machine, then runs the guest code on the machine itself
+// until it returns, and compares the two
+static void verify(hle_set* set, const hle_hook* hook, hw_state* state) {
+	hw_state native = *state;
+	native.memory = set->scratch;
+	native.watch = NULL;
+	native.hle = NULL;
+	native.recorder = NULL;
+	native.coverage = NULL;
+	native.trace = NULL;
+	memset(native.slow_pages, 0, sizeof(native.slow_pages));
+	memcpy(set->scratch, state->memory, MEMORY_SIZE);
+	hook->run(&native);
+
+	uint16_t entry_sp = state->sp;
+	uint16_t return_adr = state->memory[entry_sp] | (state->memory[(uint16_t) (entry_sp + 1)] << 8);
+	for (long steps = 0; steps < HLE_VERIFY_STEPS && !(state->pc == return_adr && state->sp > entry_sp); steps++) {
+		emulate(state);
+	}
+	set->mismatches += compare(set, hook, &native, state);
+}
+
+void hle_call(hw_state* state) {
+	hle_set* set = state->hle;
+	for (int i = 0; i < set->num_hooks; i++) {
+		if (set->hooks[i]->adr == state->pc) {
+			set->calls++;
+			if (set->verify) {
+				verify(set, set->hooks[i], state);
+			} else {
+				set->hooks[i]->run(state);
+			}
+			return;
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef HLE_H
+#define HLE_H
+#include <stdio.h>
+#include "emulator.h"
+
+#define HLE_MAX 16 // hooks installed at once
+#define HLE_VERIFY_STEPS 10000000 // longest guest run accepted when verifying a hook
+
+typedef struct hle_hook { // native C version of a guest subroutine in one particular ROM
+	const char* name;
+	uint64_t rom_hash; // hash_rom of the ROM the routine belongs to
+	uint16_t adr; // entry point
+	// Runs the routine on state, which has just called it, and returns from it. Must leave the
+	// registers, condition bits, memory (stack included), cycles and instruction count exactly as
+	// the guest code would
+	void (*run)(hw_state* state);
+} hle_hook;
+
+typedef struct hle_set { // the hooks installed in one machine
+	uint8_t hooked[MEMORY_SIZE / 8]; // one bit per entry point, checked on every CALL
+	const hle_hook* hooks[HLE_MAX];
+	int num_hooks;
+	int verify; // run the guest code as well and compare, instead of only the native version
+	FILE* out; // where verification mismatches are reported
+	uint8_t* scratch; // memory for the native run while verifying
+	uint64_t calls;
+	uint64_t mismatches;
+} hle_set;
+
+// Installs every known hook for the ROM with hash rom_hash into state. With verify set each hooked
+// call runs both versions and reports any difference to out. Returns the number of hooks installed,
+// 0 if the ROM has none or there is no memory to verify them with
+int hle_init(hle_set* set, hw_state* state, uint64_t rom_hash, int verify, FILE* out);
+void hle_free(hle_set* set, hw_state* state);
+
+static inline int hle_is_hooked(const hle_set* set, uint16_t adr) {
+	return (set->hooked[adr >> 3] >> (adr & 7)) & 1;
+}
+
+// Runs the hook for the subroutine state has just called, up to and including its return
+void hle_call(hw_state* state);
+
+#endif
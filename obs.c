@@ -0,0 +1,96 @@
+#include <string.h>
+#include "obs.h"
+
+#define SCREEN_WIDTH 224 // rows of video RAM, the screen is turned 90 degrees
+#define SCREEN_HEIGHT 256 // pixels per row of video RAM, bit 0 of the first byte at the bottom
+#define ROW_BYTES (SCREEN_HEIGHT / 8)
+
+// Spreads the 8 bits of a byte over 8 bytes, bit n to the bottom of byte n, so the pixels of
+// several rows can be counted 8 at a time with one 64 bit add
+#define U(n) ((uint64_t) ((n) & 1) | (uint64_t) ((n) >> 1 & 1) << 8 | (uint64_t) ((n) >> 2 & 1) << 16 \
+	| (uint64_t) ((n) >> 3 & 1) << 24 | (uint64_t) ((n) >> 4 & 1) << 32 | (uint64_t) ((n) >> 5 & 1) << 40 \
+	| (uint64_t) ((n) >> 6 & 1) << 48 | (uint64_t) ((n) >> 7 & 1) << 56)
+#define U4(n) U(n), U(n + 1), U(n + 2), U(n + 3)
+#define U16(n) U4(n), U4(n + 4), U4(n + 8), U4(n + 12)
+#define U64(n) U16(n), U16(n + 16), U16(n + 32), U16(n + 48)
+static const uint64_t unpack[256] = {U64(0), U64(64), U64(128), U64(192)};
+
+void obs_reset(obs_stage* stage) {
+	memset(stage->prev, 0, sizeof(stage->prev));
+	memset(stage->frames, 0, sizeof(stage->frames));
+	stage->newest = 0;
+	stage->count = 0;
+}
+
+// Shrinks pooled video RAM into out. Output column x covers video RAM rows x * 224 / 84 up to the
+// next column's and output row y covers screen rows y * 256 / 84 up to the next row's, which are
+// bits counted down from the top of the video RAM row. The rows of a column are unpacked and added
+// together a byte per pixel, then each output pixel adds up the 3 or 4 counts under it with one multiply
+static void downsample(const uint8_t* vram, uint8_t* out) {
+	uint8_t lo[OBS_HEIGHT], height[OBS_HEIGHT];
+	uint32_t mask[OBS_HEIGHT]; // selects the counts of the 3 or 4 bits from the 4 at lo
+	for (int y = 0; y < OBS_HEIGHT; y++) {
+		int top = y * SCREEN_HEIGHT / OBS_HEIGHT;
+		int bottom = (y + 1) * SCREEN_HEIGHT / OBS_HEIGHT;
+		lo[y] = SCREEN_HEIGHT - bottom;
+		height[y] = bottom - top;
+		mask[y] = height[y] == 4 ? 0xffffffff : 0x00ffffff;
+	}
+	uint32_t scale[16]; // 255 / pixels in a box, in 16.16 fixed point
+	for (int area = 1; area < 16; area++) {
+		scale[area] = (255 << 16) / area;
+	}
+	int row = 0;
+	for (int x = 0; x < OBS_WIDTH; x++) {
+		int end = (x + 1) * SCREEN_WIDTH / OBS_WIDTH;
+		int width = end - row;
+		uint64_t counts[ROW_BYTES + 1] = {0}; // byte n is the number of rows with bit n set, then padding
+		for (; row < end; row++) {
+			const uint8_t* r = &vram[row * ROW_BYTES];
+			for (int i = 0; i < ROW_BYTES; i++) {
+				counts[i] += unpack[r[i]];
+			}
+		}
+		const uint8_t* c = (const uint8_t*) counts; // little endian, so bit n of the row is byte n
+		for (int y = 0; y < OBS_HEIGHT; y++) {
+			uint32_t v;
+			memcpy(&v, c + lo[y], 4);
+			uint32_t sum = ((v & mask[y]) * 0x01010101) >> 24; // adds the bytes, none is over 3
+			out[y * OBS_WIDTH + x] = (sum * scale[width * height[y]] + 0x8000) >> 16;
+		}
+	}
+}
+
+void obs_push(obs_stage* stage, const uint8_t* memory) {
+	uint64_t now[OBS_VRAM_WORDS];
+	uint64_t pooled[OBS_VRAM_WORDS];
+	memcpy(now, memory + OBS_VRAM, OBS_VRAM_SIZE);
+	for (int i = 0; i < OBS_VRAM_WORDS; i++) {
+		pooled[i] = now[i] | stage->prev[i]; // the max of two 1bpp frames is their OR
+	}
+	memcpy(stage->prev, now, sizeof(now));
+	stage->newest = (stage->newest + 1) % OBS_STACK;
+	downsample((const uint8_t*) pooled, stage->frames[stage->newest]);
+	if (stage->count == 0) {
+		for (int i = 0; i < OBS_STACK; i++) {
+			if (i != stage->newest) {
+				memcpy(stage->frames[i], stage->frames[stage->newest], OBS_SIZE);
+			}
+		}
+	}
+	stage->count++;
+}
+
+void obs_write(const obs_stage* stage, uint8_t* out) {
+	for (int i = 1; i <= OBS_STACK; i++) {
+		memcpy(out, stage->frames[(stage->newest + i) % OBS_STACK], OBS_SIZE);
+		out += OBS_SIZE;
+	}
+}
+
+void obs_batch(obs_stage* stages, uint8_t* const* memories, int n, uint8_t* out) {
+	for (int i = 0; i < n; i++) {
+		obs_push(&stages[i], memories[i]);
+		obs_write(&stages[i], out + (size_t) i * OBS_STACK * OBS_SIZE);
+	}
+}
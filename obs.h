@@ -0,0 +1,37 @@
+#ifndef OBS_H
+#define OBS_H
+#include <stdint.h>
+
+#define OBS_WIDTH 84
+#define OBS_HEIGHT 84
+#define OBS_SIZE (OBS_WIDTH * OBS_HEIGHT) // bytes in one grayscale frame
+#define OBS_STACK 4 // frames in an observation
+#define OBS_VRAM 0x2400 // Space Invaders video RAM, 224 rows of 256 1bpp pixels
+#define OBS_VRAM_SIZE 0x1c00
+#define OBS_VRAM_WORDS (OBS_VRAM_SIZE / 8)
+
+// Builds the observations a learning agent sees of one Space Invaders machine: the screen shrunk
+// to 84x84 grayscale, max-pooled over the last two frames and stacked with the three before
+typedef struct obs_stage {
+	uint64_t prev[OBS_VRAM_WORDS]; // video RAM at the previous obs_push, for pooling
+	uint8_t frames[OBS_STACK][OBS_SIZE]; // the pooled frames, a ring indexed by newest
+	int newest;
+	int count; // frames pushed since obs_reset
+} obs_stage;
+
+// Empties the stack to black frames, as at the start of an episode
+void obs_reset(obs_stage* stage);
+
+// Adds a frame from the video RAM in memory (64K, as the machine sees it), call once per frame.
+// The screen is upright, 224 wide and 256 high. Each output pixel is the share of lit pixels in its
+// part of the screen, 0 to 255. The first frame after obs_reset fills the whole stack
+void obs_push(obs_stage* stage, const uint8_t* memory);
+
+// Writes the stacked observation into out, OBS_STACK frames of OBS_SIZE bytes, oldest first
+void obs_write(const obs_stage* stage, uint8_t* out);
+
+// Pushes a frame for each of n machines and writes their observations one after another into out,
+// which holds n * OBS_STACK * OBS_SIZE bytes
+void obs_batch(obs_stage* stages, uint8_t* const* memories, int n, uint8_t* out);
+
+#endif
@@ -0,0 +1,8 @@
+#include "opcodes.h"
+
+#define OP(code, name, operand, size, cycles, cycles_taken, flags_read, flags_written, access, ctrl) \
+	[code] = {name, OPND_##operand, size, cycles, cycles_taken, flags_read, flags_written, access, ctrl},
+
+const op_info op_table[256] = {
+#include "opcodes.def"
+};
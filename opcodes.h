@@ -0,0 +1,53 @@
+#ifndef OPCODES_H
+#define OPCODES_H
+#include <stdint.h>
+
+// How the operand bytes of an instruction are printed
+#define OPND_NONE 0
+#define OPND_D8 1 // #$ab
+#define OPND_D16 2 // #$cdab
+#define OPND_ADDR 3 // $CDAB
+
+// Condition bits, as read or written by an instruction
+#define FLAG_Z 0x01
+#define FLAG_S 0x02
+#define FLAG_P 0x04
+#define FLAG_CY 0x08
+#define FLAG_AC 0x10
+#define FLAGS_ALL (FLAG_Z | FLAG_S | FLAG_P | FLAG_CY | FLAG_AC)
+
+// Accesses an instruction makes besides fetching itself
+#define MEM_READ 0x01
+#define MEM_WRITE 0x02
+#define STACK 0x04 // pushes or pops
+#define PORT_IN 0x08
+#define PORT_OUT 0x10
+
+// How an instruction affects the flow of control
+#define CTRL_NEXT 0 // falls through to the next instruction
+#define CTRL_JUMP 1 // JMP
+#define CTRL_BRANCH 2 // conditional jump
+#define CTRL_CALL 3 // CALL
+#define CTRL_CALL_IF 4 // conditional call
+#define CTRL_RST 5 // call to a fixed vector
+#define CTRL_RET 6 // RET
+#define CTRL_RET_IF 7 // conditional return
+#define CTRL_JUMP_INDIRECT 8 // PCHL, target only known at run time
+#define CTRL_HALT 9 // HLT
+
+typedef struct op_info { // properties of one opcode, see opcodes.def
+	const char* name; // mnemonic up to the operand
+	uint8_t operand;
+	uint8_t size; // bytes
+	uint8_t cycles;
+	uint8_t cycles_taken; // cycles when a conditional call or return is taken
+	uint8_t flags_read;
+	uint8_t flags_written;
+	uint8_t access;
+	uint8_t ctrl;
+} op_info;
+
+// Indexed by opcode, built from opcodes.def
+extern const op_info op_table[256];
+
+#endif
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pool.h"
+#include "emulator.h"
+
+#define LITERAL_MAX 0x80 // bytes in one literal token
+#define RUN_MAX 0x8000 // zero bytes in one run token
+#define POOL_SPARE 16 // memory buffers kept for restores, the rest are freed
+
+// Returns host monotonic time in seconds
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ------------- COMPRESSION -------------- */
+// Machine RAM is mostly zeros (unused address space, blank screen) with short stretches of data,
+// so it is packed as runs of zeros and literal bytes. Token 0x00-0x7f is followed by that many plus
+// one literal bytes, tokens 0x80-0xff and the byte after them are a run of
+// ((token & 0x7f) << 8 | byte) + 1 zeros. Unpacking is a memset or memcpy per token
+
+// Largest packed size of len bytes
+static uint32_t pack_bound(uint32_t len) {
+	return len + len / LITERAL_MAX + 1;
+}
+
+// Returns the number of zero bytes at in, up to max
+static uint32_t zeros(const uint8_t* in, uint32_t max) {
+	uint32_t n = 0;
+	uint64_t w;
+	while (n + 8 <= max && (memcpy(&w, in + n, 8), w == 0)) {
+		n += 8;
+	}
+	while (n < max && in[n] == 0) {
+		n++;
+	}
+	return n;
+}
+
+// Packs len bytes of in into out, returns the packed size
+static uint32_t pack(const uint8_t* in, uint32_t len, uint8_t* out) {
+	uint32_t i = 0, o = 0;
+	while (i < len) {
+		uint32_t run = zeros(in + i, len - i < RUN_MAX ? len - i : RUN_MAX);
+		if (run >= 3) { // shorter runs are cheaper as literals
+			out[o++] = 0x80 | ((run - 1) >> 8);
+			out[o++] = (run - 1) & 0xff;
+			i += run;
+			continue;
+		}
+		uint32_t start = i;
+		while (i < len && i - start < LITERAL_MAX && !(i + 2 < len && in[i] == 0 && in[i+1] == 0 && in[i+2] == 0)) {
+			i++;
+		}
+		out[o++] = i - start - 1;
+		memcpy(out + o, in + start, i - start);
+		o += i - start;
+	}
+	return o;
+}
+
+// Unpacks len bytes of in into out, returns 0 unless they make exactly out_len bytes
+static int unpack(const uint8_t* in, uint32_t len, uint8_t* out, uint32_t out_len) {
+	uint32_t i = 0, o = 0;
+	while (i < len) {
+		uint8_t token = in[i++];
+		if (token & 0x80) {
+			if (i >= len) {
+				return 0;
+			}
+			uint32_t run = (((token & 0x7f) << 8) | in[i++]) + 1;
+			if (o + run > out_len) {
+				return 0;
+			}
+			memset(out + o, 0, run);
+			o += run;
+		} else {
+			uint32_t n = token + 1;
+			if (i + n > len || o + n > out_len) {
+				return 0;
+			}
+			memcpy(out + o, in + i, n);
+			i += n;
+			o += n;
+		}
+	}
+	return o == out_len;
+}
+
+/* ---------------- POOL ------------------ */
+
+static void spill_path(machine_pool* pool, int id, char* path, size_t len) {
+	snprintf(path, len, "%s/pool-%ld-%d.hib", pool->spill_dir, (long) getpid(), id);
+}
+
+// Takes id out of the list of resident machines
+static void unlink_resident(machine_pool* pool, int id) {
+	pool_instance* in = &pool->instances[id];
+	if (in->prev >= 0) {
+		pool->instances[in->prev].next = in->next;
+	} else {
+		pool->newest = in->next;
+	}
+	if (in->next >= 0) {
+		pool->instances[in->next].prev = in->prev;
+	} else {
+		pool->oldest = in->prev;
+	}
+	in->prev = in->next = -1;
+}
+
+// Puts id at the most recently used end of the list of resident machines
+static void push_resident(machine_pool* pool, int id) {
+	pool_instance* in = &pool->instances[id];
+	in->prev = -1;
+	in->next = pool->newest;
+	if (pool->newest >= 0) {
+		pool->instances[pool->newest].prev = id;
+	} else {
+		pool->oldest = id;
+	}
+	pool->newest = id;
+}
+
+// Returns a 64K buffer for a machine, reusing one given up by hibernation if there is one
+static uint8_t* take_memory(machine_pool* pool) {
+	if (pool->num_spare > 0) {
+		return pool->spare[--pool->num_spare];
+	}
+	return malloc(MEMORY_SIZE);
+}
+
+static void give_memory(machine_pool* pool, uint8_t* memory) {
+	if (pool->num_spare < POOL_SPARE) {
+		pool->spare[pool->num_spare++] = memory;
+	} else {
+		free(memory);
+	}
+}
+
+// Makes room for one more resident machine, other than keep, by hibernating the least recently used
+static int make_room(machine_pool* pool, int keep) {
+	while (pool->max_resident > 0 && pool->resident >= pool->max_resident) {
+		int victim = pool->oldest == keep ? pool->instances[keep].prev : pool->oldest;
+		if (victim < 0 || !pool_hibernate(pool, victim)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int pool_init(machine_pool* pool, const uint8_t* rom, uint32_t rom_len, const core_io* io,
+	int max_resident, double idle_seconds, const char* spill_dir) {
+	memset(pool, 0, sizeof(*pool));
+	pool->rom = rom;
+	pool->rom_len = rom_len < MEMORY_SIZE ? rom_len : MEMORY_SIZE;
+	if (io != NULL) {
+		pool->io = *io;
+	}
+	pool->max_resident = max_resident;
+	pool->idle_seconds = idle_seconds;
+	pool->spill_dir = spill_dir;
+	pool->newest = pool->oldest = -1;
+	pool->spare = malloc(POOL_SPARE * sizeof(uint8_t*));
+	pool->scratch = malloc(pack_bound(MEMORY_SIZE));
+	return pool->spare != NULL && pool->scratch != NULL;
+}
+
+void pool_free(machine_pool* pool) {
+	for (int id = 0; id < pool->num_instances; id++) {
+		pool_instance* in = &pool->instances[id];
+		core_free(in->cpu);
+		free(in->memory);
+		free(in->blob);
+		if (in->spilled) {
+			char path[4096];
+			spill_path(pool, id, path, sizeof(path));
+			remove(path);
+		}
+	}
+	for (int i = 0; i < pool->num_spare; i++) {
+		free(pool->spare[i]);
+	}
+	free(pool->spare);
+	free(pool->scratch);
+	free(pool->instances);
+	memset(pool, 0, sizeof(*pool));
+}
+
+int pool_add(machine_pool* pool) {
+	if (pool->num_instances == pool->capacity) {
+		int capacity = pool->capacity ? pool->capacity * 2 : 64;
+		pool_instance* instances = realloc(pool->instances, capacity * sizeof(pool_instance));
+		if (instances == NULL) {
+			return -1;
+		}
+		pool->instances = instances;
+		pool->capacity = capacity;
+	}
+	if (!make_room(pool, -1)) {
+		return -1;
+	}
+	uint8_t* memory = take_memory(pool);
+	if (memory == NULL) {
+		return -1;
+	}
+	memcpy(memory, pool->rom, pool->rom_len);
+	memset(memory + pool->rom_len, 0, MEMORY_SIZE - pool->rom_len);
+	core* cpu = core_new(memory, &pool->io);
+	if (cpu == NULL) {
+		give_memory(pool, memory);
+		return -1;
+	}
+	int id = pool->num_instances++;
+	pool_instance* in = &pool->instances[id];
+	memset(in, 0, sizeof(*in));
+	in->cpu = cpu;
+	in->memory = memory;
+	in->last_used = now();
+	push_resident(pool, id);
+	pool->resident++;
+	return id;
+}
+
+int pool_hibernate(machine_pool* pool, int id) {
+	pool_instance* in = &pool->instances[id];
+	if (in->memory == NULL) {
+		return 1;
+	}
+	uint32_t len = pack(in->memory + pool->rom_len, MEMORY_SIZE - pool->rom_len, pool->scratch);
+	if (pool->spill_dir != NULL) {
+		char path[4096];
+		spill_path(pool, id, path, sizeof(path));
+		int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			return 0;
+		}
+		int ok = write(fd, pool->scratch, len) == len;
+		ok = (close(fd) == 0) && ok;
+		if (!ok) {
+			remove(path);
+			return 0;
+		}
+		in->spilled = 1;
+	} else {
+		in->blob = malloc(len);
+		if (in->blob == NULL) {
+			return 0;
+		}
+		memcpy(in->blob, pool->scratch, len);
+	}
+	in->blob_len = len;
+	unlink_resident(pool, id);
+	core_set_memory(in->cpu, NULL);
+	give_memory(pool, in->memory);
+	in->memory = NULL;
+	pool->resident--;
+	pool->stats.hibernations++;
+	pool->stats.blob_bytes += len;
+	return 1;
+}
+
+// Brings a hibernated machine back, returns 0 if its blob could not be read
+static int restore(machine_pool* pool, int id) {
+	pool_instance* in = &pool->instances[id];
+	double start = now(); // the latency a caller sees, including making room
+	if (!make_room(pool, id)) {
+		return 0;
+	}
+	uint8_t* memory = take_memory(pool);
+	if (memory == NULL) {
+		return 0;
+	}
+	const uint8_t* blob = in->blob;
+	char path[4096];
+	if (in->spilled) {
+		spill_path(pool, id, path, sizeof(path));
+		int fd = open(path, O_RDONLY);
+		int ok = fd >= 0 && read(fd, pool->scratch, in->blob_len) == in->blob_len;
+		if (fd >= 0) {
+			close(fd);
+		}
+		if (!ok) {
+			give_memory(pool, memory);
+			return 0;
+		}
+		blob = pool->scratch;
+	}
+	memcpy(memory, pool->rom, pool->rom_len);
+	if (!unpack(blob, in->blob_len, memory + pool->rom_len, MEMORY_SIZE - pool->rom_len)) {
+		give_memory(pool, memory);
+		return 0;
+	}
+	if (in->spilled) {
+		remove(path);
+		in->spilled = 0;
+	}
+	free(in->blob);
+	in->blob = NULL;
+	pool->stats.blob_bytes -= in->blob_len;
+	in->blob_len = 0;
+	in->memory = memory;
+	core_set_memory(in->cpu, memory);
+	push_resident(pool, id);
+	pool->resident++;
+	double seconds = now() - start;
+	pool->stats.restores++;
+	pool->stats.restore_seconds += seconds;
+	if (seconds > pool->stats.restore_max) {
+		pool->stats.restore_max = seconds;
+	}
+	return 1;
+}
+
+core* pool_get(machine_pool* pool, int id) {
+	if (id < 0 || id >= pool->num_instances) {
+		return NULL;
+	}
+	pool_instance* in = &pool->instances[id];
+	if (in->memory == NULL) {
+		if (!restore(pool, id)) {
+			return NULL;
+		}
+	} else if (pool->newest != id) {
+		unlink_resident(pool, id);
+		push_resident(pool, id);
+	}
+	in->last_used = now();
+	return in->cpu;
+}
+
+void pool_maintain(machine_pool* pool) {
+	if (pool->idle_seconds <= 0) {
+		return;
+	}
+	double t = now();
+	while (pool->oldest >= 0 && t - pool->instances[pool->oldest].last_used >= pool->idle_seconds) {
+		if (!pool_hibernate(pool, pool->oldest)) {
+			break;
+		}
+		pool->stats.idle_hibernations++;
+	}
+}
+
+/* ---------------- DEMO ------------------ */
+
+int run_pool(const char* path, int instances, int resident, double idle_seconds, long frames, const char* spill_dir, FILE* out) {
+	byte* rom = calloc(MEMORY_SIZE, sizeof(byte));
+	if (rom == NULL) {
+		fprintf(out, "Out of memory\n");
+		return 1;
+	}
+	long rom_len = load_rom(path, rom);
+	if (rom_len < 0) {
+		fprintf(out, "Could not open file %s\n", path);
+		free(rom);
+		return 1;
+	}
+	machine_pool pool;
+	if (!pool_init(&pool, rom, rom_len, NULL, resident, idle_seconds, spill_dir)) {
+		fprintf(out, "Out of memory\n");
+		free(rom);
+		return 1;
+	}
+	for (int i = 0; i < instances; i++) {
+		if (pool_add(&pool) < 0) {
+			fprintf(out, "Could not add machine %d, out of memory or the spill directory is not writable\n", i);
+			pool_free(&pool);
+			free(rom);
+			return 1;
+		}
+	}
+	core* reference = core_new(NULL, NULL); // the same machine, never hibernated
+	if (reference == NULL) {
+		fprintf(out, "Out of memory\n");
+		pool_free(&pool);
+		free(rom);
+		return 1;
+	}
+	memcpy(core_memory(reference), rom, rom_len);
+
+	double start = now();
+	for (long f = 0; f < frames; f++) {
+		for (int id = 0; id < instances; id++) {
+			core* cpu = pool_get(&pool, id);
+			if (cpu == NULL) {
+				fprintf(out, "Could not restore machine %d\n", id);
+				core_free(reference);
+				pool_free(&pool);
+				free(rom);
+				return 1;
+			}
+			run_frame(core_machine(cpu));
+		}
+		run_frame(core_machine(reference));
+		pool_maintain(&pool); // machines that ran early in the round may have been idle long enough
+	}
+	double seconds = now() - start;
+
+	hw_state* first = core_machine(pool_get(&pool, 0));
+	hw_state* ref = core_machine(reference);
+	core_regs a, b;
+	core_get_regs(pool.instances[0].cpu, &a);
+	core_get_regs(reference, &b);
+	int same = memcmp(&a, &b, sizeof(a)) == 0
+		&& memcmp(&first->counters, &ref->counters, sizeof(ref->counters)) == 0
+		&& memcmp(first->memory, ref->memory, MEMORY_SIZE) == 0;
+
+	pool_stats* s = &pool.stats;
+	uint64_t hibernated = instances - pool.resident;
+	fprintf(out, "pool: %d machines, at most %d resident, %ld frames each in %.2f s\n", instances,
+		resident > 0 ? resident : instances, frames, seconds);
+	fprintf(out, "pool: %llu hibernations (%llu after %g s idle), %llu restores, restore mean %.1f us max %.1f us\n",
+		(unsigned long long) s->hibernations, (unsigned long long) s->idle_hibernations, idle_seconds,
+		(unsigned long long) s->restores,
+		s->restores ? s->restore_seconds / s->restores * 1e6 : 0, s->restore_max * 1e6);
+	fprintf(out, "pool: %llu KB of memory and blobs (mean blob %llu bytes) against %llu KB with every machine resident\n",
+		(unsigned long long) ((pool.resident + pool.num_spare) * (uint64_t) MEMORY_SIZE + s->blob_bytes) / 1024,
+		(unsigned long long) (hibernated ? s->blob_bytes / hibernated : 0),
+		(unsigned long long) instances * MEMORY_SIZE / 1024);
+	fprintf(out, "pool: machine 0 %s a machine that was never hibernated\n", same ? "matches" : "DIFFERS from");
+	core_free(reference);
+	pool_free(&pool);
+	free(rom);
+	return same ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+#ifndef POOL_H
+#define POOL_H
+#include <stdio.h>
+#include <stdint.h>
+#include "core.h"
+
+// A pool of machines running the same ROM, more of them than there is memory for. An idle machine
+// can be hibernated: its RAM (everything above the ROM, which every machine shares) is compressed
+// into a blob in memory or a spill file, and its 64K of memory goes back to the pool. The core
+// itself, a few hundred bytes of registers and settings, stays, so pool_get brings a machine back
+// just by unpacking its RAM. Machines must not write to their ROM, which is not saved
+
+typedef struct pool_instance {
+	core* cpu;
+	uint8_t* memory; // NULL while hibernated
+	uint8_t* blob; // compressed RAM while hibernated in memory
+	uint32_t blob_len;
+	uint8_t spilled; // the blob is in a spill file
+	double last_used; // host time of the last pool_get
+	int prev, next; // neighbours in the list of resident machines, most recently used first
+} pool_instance;
+
+typedef struct pool_stats {
+	uint64_t hibernations;
+	uint64_t idle_hibernations; // the part of hibernations made by pool_maintain
+	uint64_t restores;
+	double restore_seconds; // total time spent restoring
+	double restore_max;
+	uint64_t blob_bytes; // size of the blobs held now, in memory or spilled
+} pool_stats;
+
+typedef struct machine_pool {
+	const uint8_t* rom; // copied into every machine's memory, owned by the caller
+	uint32_t rom_len;
+	core_io io; // given to every machine
+	int max_resident; // machines holding memory at once, 0 for no limit
+	double idle_seconds; // pool_maintain hibernates machines unused this long, 0 never
+	const char* spill_dir; // directory for blobs, NULL to keep them in memory
+	pool_instance* instances;
+	int num_instances;
+	int capacity;
+	int newest, oldest; // ends of the resident list, -1 if empty
+	int resident;
+	uint8_t** spare; // memory of hibernated machines, kept for the next restore
+	int num_spare;
+	uint8_t* scratch; // compression buffer, big enough for the worst case
+	pool_stats stats;
+} machine_pool;
+
+// Sets up an empty pool. rom is rom_len bytes loaded at address 0 of every machine. Returns 0 if out of memory
+int pool_init(machine_pool* pool, const uint8_t* rom, uint32_t rom_len, const core_io* io,
+	int max_resident, double idle_seconds, const char* spill_dir);
+
+// Frees every machine, blob and spill file
+void pool_free(machine_pool* pool);
+
+// Adds a machine at reset with the ROM loaded, returns its id or -1 if out of memory
+int pool_add(machine_pool* pool);
+
+// Returns the machine with the given id ready to run, restoring it if it is hibernated. This may
+// hibernate the least recently used machine to stay within max_resident, so a core returned earlier
+// is only good until the next pool call. Returns NULL if the machine could not be restored
+core* pool_get(machine_pool* pool, int id);
+
+// Hibernates the machine now, returns 0 if its blob could not be stored
+int pool_hibernate(machine_pool* pool, int id);
+
+// Hibernates the machines that have been idle for idle_seconds, call it now and then
+void pool_maintain(machine_pool* pool);
+
+// Runs instances copies of the ROM at path through a pool holding at most resident of them (0 for
+// all), a frame each in turn for frames rounds, calling pool_maintain after each round to hibernate
+// machines idle for idle_seconds (0 never). Checks that the first one ends exactly like a machine
+// that was never hibernated. Blobs go to spill_dir if it is not NULL. Writes the restore latency and
+// memory use to out. Returns 0 on success
+int run_pool(const char* path, int instances, int resident, double idle_seconds, long frames, const char* spill_dir, FILE* out);
+
+#endif
@@ -0,0 +1,265 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "profiler.h"
+#include "decode.h"
+#include "opcodes.h"
+
+/* ----------- CALL PATHS ------------- */
+
+// Returns the node for subroutine addr called from node parent, creating it if necessary.
+// Returns parent itself if the node table is full so its cycles are still counted somewhere
+static int32_t find_node(profile* prof, int32_t parent, uint16_t addr) {
+	uint32_t bucket = ((uint32_t) parent * 2654435761u ^ addr) % PROFILE_BUCKETS;
+	for (int32_t n = prof->buckets[bucket]; n >= 0; n = prof->nodes[n].next) {
+		if (prof->nodes[n].parent == parent && prof->nodes[n].addr == addr) {
+			return n;
+		}
+	}
+	if (prof->num_nodes == PROFILE_MAX_NODES) {
+		return parent;
+	}
+	int32_t n = prof->num_nodes++;
+	prof->nodes[n] = (profile_node) {.addr = addr, .parent = parent, .next = prof->buckets[bucket]};
+	prof->buckets[bucket] = n;
+	return n;
+}
+
+profile* profile_new(hw_state* state) {
+	profile* prof = calloc(1, sizeof(profile));
+	if (prof == NULL) {
+		return NULL;
+	}
+	prof->nodes = calloc(PROFILE_MAX_NODES, sizeof(profile_node));
+	if (prof->nodes == NULL) {
+		free(prof);
+		return NULL;
+	}
+	memset(prof->buckets, 0xff, sizeof(prof->buckets)); // all buckets empty (-1)
+	prof->stack[0] = find_node(prof, -1, state->pc);
+	prof->nodes[prof->stack[0]].calls = 1;
+	prof->stack_sp[0] = 0xffff;
+	prof->depth = 1;
+	return prof;
+}
+
+void profile_free(profile* prof) {
+	if (prof != NULL) {
+		free(prof->nodes);
+		free(prof);
+	}
+}
+
+// Returns 1 if op is CALL, a conditional call or RST
+static int is_call(uint8_t op) {
+	uint8_t ctrl = op_table[op].ctrl;
+	return ctrl == CTRL_CALL || ctrl == CTRL_CALL_IF || ctrl == CTRL_RST;
+}
+
+// Returns 1 if op is RET or a conditional return
+static int is_ret(uint8_t op) {
+	return op_table[op].ctrl == CTRL_RET || op_table[op].ctrl == CTRL_RET_IF;
+}
+
+// Opens a frame for the subroutine the PC is now at, just after its return address was pushed
+static void enter(profile* prof, hw_state* state) {
+	if (prof->depth < PROFILE_MAX_DEPTH) {
+		int32_t n = find_node(prof, prof->stack[prof->depth-1], state->pc);
+		prof->nodes[n].calls++;
+		prof->stack[prof->depth] = n;
+		prof->stack_sp[prof->depth] = state->sp;
+		prof->depth++;
+	}
+}
+
+void profile_step(profile* prof, hw_state* state) {
+	uint16_t pc = state->pc;
+	uint16_t sp = state->sp;
+	uint8_t op = state->memory[pc];
+	uint64_t cycles = state->cycles;
+
+	emulate(state);
+
+	cycles = state->cycles - cycles;
+	prof->instructions++;
+	prof->cycles += cycles;
+	prof->pc_count[pc]++;
+	prof->pc_cycles[pc] += cycles;
+	prof->op_count[op]++;
+	prof->op_cycles[op] += cycles;
+	prof->nodes[prof->stack[prof->depth-1]].self_cycles += cycles;
+
+	if (is_call(op) && state->sp == (uint16_t) (sp - 2)) { // call was taken: a return address was pushed
+		enter(prof, state);
+	} else if (is_ret(op) && state->sp > sp) { // return was taken: unwind every frame whose return address is now popped
+		while (prof->depth > 1 && prof->stack_sp[prof->depth-1] < state->sp) {
+			prof->depth--;
+		}
+	}
+}
+
+void profile_interrupt(profile* prof, hw_state* state) {
+	int enabled = state->interrupt_enabled;
+	frame_interrupt(state);
+	if (enabled) {
+		enter(prof, state);
+	}
+}
+
+// profile_step until the clock reaches cycles, letting a halted machine's clock run on as run_until does
+static void profile_until(profile* prof, hw_state* state, uint64_t cycles) {
+	while (state->cycles < cycles) {
+		if (state->halted) {
+			state->cycles = cycles;
+			return;
+		}
+		profile_step(prof, state);
+	}
+}
+
+void profile_frame(profile* prof, hw_state* state) {
+	if (!state->frame_half) {
+		profile_until(prof, state, frame_interrupt_due(state));
+		profile_interrupt(prof, state);
+	}
+	profile_until(prof, state, frame_interrupt_due(state));
+	profile_interrupt(prof, state);
+}
+
+/* ------------- REPORTS -------------- */
+
+static uint64_t* sort_key; // array the qsort comparator orders by, descending
+
+static int by_key_desc(const void* x, const void* y) {
+	uint64_t a = sort_key[*(const int*) x];
+	uint64_t b = sort_key[*(const int*) y];
+	return (a < b) - (a > b);
+}
+
+// Sorts the n indices in order by key[index], largest first
+static void sort_indices(int* order, int n, uint64_t* key) {
+	sort_key = key;
+	qsort(order, n, sizeof(int), by_key_desc);
+}
+
+// Writes the mnemonic of opcode op with its operands stripped into buf
+static void opcode_name(char* buf, size_t len, uint8_t op) {
+	BYTE code[3] = {op, 0, 0};
+	format_op(buf, len, code, 0);
+	buf[strcspn(buf, "#$")] = '\0';
+	size_t n = strlen(buf);
+	if (n > 0 && buf[n-1] == ',') {
+		buf[n-1] = '\0';
+	}
+}
+
+static double percent(uint64_t part, uint64_t total) {
+	return total ? 100.0 * part / total : 0.0;
+}
+
+int profile_write_report(profile* prof, hw_state* state, const char* path, int top) {
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL) {
+		return 0;
+	}
+	char text[32];
+	int* order = malloc(MEMORY_SIZE * sizeof(int));
+	int n;
+
+	fprintf(fp, "%llu instructions, %llu cycles\n\n",
+		(unsigned long long) prof->instructions, (unsigned long long) prof->cycles);
+
+	fprintf(fp, "Hot addresses\n%-6s %12s %14s %7s  %s\n", "ADDR", "COUNT", "CYCLES", "%", "INSTRUCTION");
+	n = 0;
+	for (int pc = 0; pc < MEMORY_SIZE; pc++) {
+		if (prof->pc_count[pc]) {
+			order[n++] = pc;
+		}
+	}
+	sort_indices(order, n, prof->pc_cycles);
+	for (int i = 0; i < n && i < top; i++) {
+		int pc = order[i];
+		format_op(text, sizeof(text), state->memory, pc);
+		fprintf(fp, "%04X   %12llu %14llu %6.2f%%  %s\n", pc, (unsigned long long) prof->pc_count[pc],
+			(unsigned long long) prof->pc_cycles[pc], percent(prof->pc_cycles[pc], prof->cycles), text);
+	}
+
+	fprintf(fp, "\nOpcodes\n%-6s %12s %14s %7s  %s\n", "OP", "COUNT", "CYCLES", "%", "MNEMONIC");
+	n = 0;
+	for (int op = 0; op < 256; op++) {
+		if (prof->op_count[op]) {
+			order[n++] = op;
+		}
+	}
+	sort_indices(order, n, prof->op_cycles);
+	for (int i = 0; i < n; i++) {
+		int op = order[i];
+		opcode_name(text, sizeof(text), op);
+		fprintf(fp, "%02X     %12llu %14llu %6.2f%%  %s\n", op, (unsigned long long) prof->op_count[op],
+			(unsigned long long) prof->op_cycles[op], percent(prof->op_cycles[op], prof->cycles), text);
+	}
+
+	// Total the call path nodes by subroutine. Inclusive cycles count each node once per distinct
+	// subroutine on its path, so recursion does not count the same cycles twice
+	uint64_t* self = calloc(MEMORY_SIZE, sizeof(uint64_t));
+	uint64_t* total = calloc(MEMORY_SIZE, sizeof(uint64_t));
+	uint64_t* calls = calloc(MEMORY_SIZE, sizeof(uint64_t));
+	int32_t* seen = malloc(MEMORY_SIZE * sizeof(int32_t));
+	memset(seen, 0xff, MEMORY_SIZE * sizeof(int32_t));
+	for (int32_t i = 0; i < prof->num_nodes; i++) {
+		profile_node* node = &prof->nodes[i];
+		self[node->addr] += node->self_cycles;
+		calls[node->addr] += node->calls;
+		for (int32_t a = i; a >= 0; a = prof->nodes[a].parent) {
+			uint16_t addr = prof->nodes[a].addr;
+			if (seen[addr] != i) {
+				seen[addr] = i;
+				total[addr] += node->self_cycles;
+			}
+		}
+	}
+	fprintf(fp, "\nSubroutines\n%-6s %12s %14s %7s %14s %7s  %s\n", "ADDR", "CALLS", "SELF", "%", "TOTAL", "%", "FIRST INSTRUCTION");
+	n = 0;
+	for (int addr = 0; addr < MEMORY_SIZE; addr++) {
+		if (calls[addr]) {
+			order[n++] = addr;
+		}
+	}
+	sort_indices(order, n, total);
+	for (int i = 0; i < n && i < top; i++) {
+		int addr = order[i];
+		format_op(text, sizeof(text), state->memory, addr);
+		fprintf(fp, "%04X   %12llu %14llu %6.2f%% %14llu %6.2f%%  %s\n", addr, (unsigned long long) calls[addr],
+			(unsigned long long) self[addr], percent(self[addr], prof->cycles),
+			(unsigned long long) total[addr], percent(total[addr], prof->cycles), text);
+	}
+
+	free(self);
+	free(total);
+	free(calls);
+	free(seen);
+	free(order);
+	return fclose(fp) == 0;
+}
+
+int profile_write_folded(profile* prof, const char* path) {
+	FILE* fp = fopen(path, "w");
+	if (fp == NULL) {
+		return 0;
+	}
+	uint16_t frames[PROFILE_MAX_DEPTH + 1];
+	for (int32_t i = 0; i < prof->num_nodes; i++) {
+		if (prof->nodes[i].self_cycles == 0) {
+			continue;
+		}
+		int depth = 0;
+		for (int32_t a = i; a >= 0 && depth <= PROFILE_MAX_DEPTH; a = prof->nodes[a].parent) {
+			frames[depth++] = prof->nodes[a].addr;
+		}
+		while (depth-- > 0) { // print outermost frame first
+			fprintf(fp, "sub_%04X%c", frames[depth], depth ? ';' : ' ');
+		}
+		fprintf(fp, "%llu\n", (unsigned long long) prof->nodes[i].self_cycles);
+	}
+	return fclose(fp) == 0;
+}
@@ -0,0 +1,52 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include "emulator.h"
+
+#define PROFILE_MAX_DEPTH 256 // deepest guest call stack that is tracked
+#define PROFILE_MAX_NODES 65536 // number of distinct guest call paths that can be recorded
+#define PROFILE_BUCKETS 16384 // hash buckets for looking up call paths
+
+typedef struct profile_node { // a guest subroutine reached through one particular call path
+	uint16_t addr; // entry address of the subroutine
+	int32_t parent; // node of the caller, -1 for the root
+	int32_t next; // next node in the same hash bucket
+	uint64_t calls; // number of times the subroutine was entered along this path
+	uint64_t self_cycles; // cycles spent in the subroutine itself, excluding its callees
+} profile_node;
+
+typedef struct profile { // execution profile of a guest program
+	uint64_t instructions;
+	uint64_t cycles;
+	uint64_t pc_count[MEMORY_SIZE]; // times the instruction at each address was executed
+	uint64_t pc_cycles[MEMORY_SIZE]; // cycles spent in the instruction at each address
+	uint64_t op_count[256]; // times each opcode was executed
+	uint64_t op_cycles[256]; // cycles spent in each opcode
+	int32_t stack[PROFILE_MAX_DEPTH]; // node of each active guest frame, stack[0] is the root
+	uint16_t stack_sp[PROFILE_MAX_DEPTH]; // guest SP just after each frame's return address was pushed
+	int depth; // number of active frames, including the root
+	int32_t buckets[PROFILE_BUCKETS];
+	profile_node* nodes;
+	int num_nodes;
+} profile;
+
+// Allocates an empty profile whose root frame starts at the current PC of state, NULL if out of memory
+profile* profile_new(hw_state* state);
+void profile_free(profile* prof);
+
+// Executes next instruction for processor in state hw_state and records it in prof
+void profile_step(profile* prof, hw_state* state);
+
+// Delivers the frame interrupt that is due as frame_interrupt does and records the handler as a
+// subroutine called from wherever the guest was interrupted
+void profile_interrupt(profile* prof, hw_state* state);
+
+// Executes one video frame as run_frame does, recording every instruction and interrupt in prof
+void profile_frame(profile* prof, hw_state* state);
+
+// Writes the hot address, opcode and subroutine tables to path, annotated with mnemonics. Returns 1 on success
+int profile_write_report(profile* prof, hw_state* state, const char* path, int top);
+
+// Writes one line per guest call path with its cycle count, in the folded format used by flame graph tools
+int profile_write_folded(profile* prof, const char* path);
+
+#endif
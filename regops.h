@@ -0,0 +1,114 @@
+#ifndef REGOPS_H
+#define REGOPS_H
+#include <stdint.h>
+#include "emulator.h"
+
+// Handlers for the opcodes that take their operands from registers: MOV r,r (0x40-0x7f) and the
+// ADD/ADC/SUB/SBB/ANA/XRA/ORA/CMP groups (0x80-0xbf). Each handler is stamped out by a macro for
+// its exact registers, so it compiles to a few loads, stores and flag updates with no switch on a
+// register name. check.c tests every one of them against a reference model
+
+/* ------------- OPERANDS -------------- */
+
+// Reading and writing each operand, M is the memory byte addressed by HL
+#define GET_B state->b
+#define GET_C state->c
+#define GET_D state->d
+#define GET_E state->e
+#define GET_H state->h
+#define GET_L state->l
+#define GET_M mem_read(state, (state->h << 8) | state->l)
+#define GET_A state->a
+#define SET_B(v) state->b = (v)
+#define SET_C(v) state->c = (v)
+#define SET_D(v) state->d = (v)
+#define SET_E(v) state->e = (v)
+#define SET_H(v) state->h = (v)
+#define SET_L(v) state->l = (v)
+#define SET_M(v) mem_write(state, (state->h << 8) | state->l, (v))
+#define SET_A(v) state->a = (v)
+
+// Calls X(r) for every operand, in the order the opcode's register fields encode them
+#define FOR_EACH_REG(X) X(B) X(C) X(D) X(E) X(H) X(L) X(M) X(A)
+#define FOR_EACH_SRC(X, dst) X(dst, B) X(dst, C) X(dst, D) X(dst, E) X(dst, H) X(dst, L) X(dst, M) X(dst, A)
+
+/* ------------- ALU -------------- */
+
+// Returns 1 if v has an even number of ones
+static inline uint8_t parity(uint8_t v) {
+	v ^= v >> 4;
+	v ^= v >> 2;
+	v ^= v >> 1;
+	return !(v & 1);
+}
+
+// Sets the zero, sign and parity bits from an 8 bit result
+static inline void set_zsp(hw_state* state, uint8_t answer) {
+	state->cc.z = answer == 0;
+	state->cc.s = answer >> 7; // 1 if bit 7 is 1 (answer is negative), 0 otherwise
+	state->cc.p = parity(answer);
+}
+
+// Adds v and carry to the accumulator
+static inline void alu_add(hw_state* state, uint8_t v, uint8_t carry) {
+	uint16_t answer = state->a + v + carry; // keep 16 bit answer to determine carry
+	state->cc.cy = answer >> 8;
+	state->cc.ac = ((state->a ^ v ^ answer) >> 4) & 1; // carry out of bit 3
+	state->a = answer & 0xff;
+	set_zsp(state, state->a);
+}
+
+// Returns the accumulator minus v and borrow, setting the condition bits. The 8080 adds the
+// complement of v, so the auxiliary carry is the carry out of bit 3 of that addition
+static inline uint8_t alu_sub(hw_state* state, uint8_t v, uint8_t borrow) {
+	uint16_t answer = state->a + (uint8_t) ~v + !borrow;
+	state->cc.cy = !(answer >> 8); // carry is set when there was a borrow
+	state->cc.ac = ((state->a ^ ~v ^ answer) >> 4) & 1;
+	set_zsp(state, answer & 0xff);
+	return answer & 0xff;
+}
+
+// Perform bitwise AND between v and accumulator. The 8080 sets the auxiliary carry to the OR of bit 3 of the operands
+static inline void alu_and(hw_state* state, uint8_t v) {
+	state->cc.ac = ((state->a | v) >> 3) & 1;
+	state->a &= v;
+	state->cc.cy = 0;
+	set_zsp(state, state->a);
+}
+
+// Perform bitwise XOR between v and accumulator
+static inline void alu_xor(hw_state* state, uint8_t v) {
+	state->a ^= v;
+	state->cc.cy = 0;
+	state->cc.ac = 0;
+	set_zsp(state, state->a);
+}
+
+// Perform bitwise OR between v and accumulator
+static inline void alu_or(hw_state* state, uint8_t v) {
+	state->a |= v;
+	state->cc.cy = 0;
+	state->cc.ac = 0;
+	set_zsp(state, state->a);
+}
+
+/* ------------- HANDLERS -------------- */
+
+// mov_D_S(state) copies register S to register D. mov_M_M is generated but never used, 0x76 is HLT
+#define DEFINE_MOV(dst, src) static inline void mov_##dst##_##src(hw_state* state) { SET_##dst(GET_##src); }
+#define DEFINE_MOVS_TO(dst) FOR_EACH_SRC(DEFINE_MOV, dst)
+FOR_EACH_REG(DEFINE_MOVS_TO)
+
+// add_S(state) ... cmp_S(state) apply the operation to the accumulator and register S
+#define DEFINE_ALU(src) \
+	static inline void add_##src(hw_state* state) { alu_add(state, GET_##src, 0); } \
+	static inline void adc_##src(hw_state* state) { alu_add(state, GET_##src, state->cc.cy); } \
+	static inline void sub_##src(hw_state* state) { state->a = alu_sub(state, GET_##src, 0); } \
+	static inline void sbb_##src(hw_state* state) { state->a = alu_sub(state, GET_##src, state->cc.cy); } \
+	static inline void ana_##src(hw_state* state) { alu_and(state, GET_##src); } \
+	static inline void xra_##src(hw_state* state) { alu_xor(state, GET_##src); } \
+	static inline void ora_##src(hw_state* state) { alu_or(state, GET_##src); } \
+	static inline void cmp_##src(hw_state* state) { alu_sub(state, GET_##src, 0); }
+FOR_EACH_REG(DEFINE_ALU)
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sound.h"
+#include "emulator.h"
+
+#define RING_MASK (SOUND_RING_SIZE - 1)
+#define AMP_ENABLE 0x20 // port 3 bit 5 turns the amplifier on
+
+// The sounds, in port bit order: port 3 bits 0-4 then port 5 bits 0-4. The board plays recorded
+// analogue circuits, which are not shipped here, so each one is approximated by a swept square
+// wave or decaying noise
+typedef struct voice_spec {
+	const char* name;
+	double seconds;
+	double freq; // square wave frequency at the start, 0 for noise
+	double freq_end; // frequency at the end, swept linearly
+	double wobble_hz; // frequency modulation rate
+	double wobble; // frequency modulation depth
+	double decay; // seconds for the volume to fall to 1/e, 0 for constant volume
+	int beeps; // gate the sound on and off this many times, 0 for continuous
+	int loop; // repeats while its port bit is set
+} voice_spec;
+
+static const voice_spec voice_specs[SOUND_VOICES] = {
+	{"ufo", 0.1, 500, 500, 10, 200, 0, 0, 1}, // a whole number of cycles so the loop joins up
+	{"shot", 0.25, 0, 0, 0, 0, 0.08, 0, 0},
+	{"player die", 1.0, 0, 0, 0, 0, 0.35, 0, 0},
+	{"invader die", 0.2, 800, 200, 0, 0, 0, 0, 0},
+	{"extra life", 0.45, 1000, 1000, 0, 0, 0, 3, 0},
+	{"fleet 1", 0.08, 110, 110, 0, 0, 0.04, 0, 0},
+	{"fleet 2", 0.08, 98, 98, 0, 0, 0.04, 0, 0},
+	{"fleet 3", 0.08, 87, 87, 0, 0, 0.04, 0, 0},
+	{"fleet 4", 0.08, 82, 82, 0, 0, 0.04, 0, 0},
+	{"ufo hit", 1.0, 450, 450, 8, 150, 0, 0, 0},
+};
+
+// Renders spec into out, len samples
+static void synthesise(const voice_spec* spec, int16_t* out, uint32_t len) {
+	double phase = 0;
+	uint32_t noise = 0x12345678;
+	for (uint32_t i = 0; i < len; i++) {
+		double t = (double) i / SOUND_RATE;
+		double v;
+		if (spec->freq == 0) {
+			noise ^= noise << 13; // xorshift32
+			noise ^= noise >> 17;
+			noise ^= noise << 5;
+			v = (noise & 0x10000) ? 1 : -1;
+		} else {
+			double freq = spec->freq + (spec->freq_end - spec->freq) * t / spec->seconds
+				+ spec->wobble * sin(2 * M_PI * spec->wobble_hz * t);
+			phase += freq / SOUND_RATE;
+			phase -= floor(phase);
+			v = phase < 0.5 ? 1 : -1;
+		}
+		if (spec->decay > 0) {
+			v *= exp(-t / spec->decay);
+		}
+		if (spec->beeps && ((int) (t / spec->seconds * spec->beeps * 2) & 1)) {
+			v = 0;
+		}
+		out[i] = (int16_t) (v * 6000); // room for several sounds at once
+	}
+}
+
+int sound_init(sound_device* dev, core* cpu) {
+	memset(dev, 0, sizeof(*dev));
+	dev->cpu = cpu;
+	uint32_t total = 0;
+	for (int i = 0; i < SOUND_VOICES; i++) {
+		total += voice_specs[i].seconds * SOUND_RATE;
+	}
+	dev->tables = malloc(total * sizeof(int16_t));
+	if (dev->tables == NULL) {
+		return 0;
+	}
+	int16_t* p = dev->tables;
+	for (int i = 0; i < SOUND_VOICES; i++) {
+		sound_voice* v = &dev->voices[i];
+		v->data = p;
+		v->len = voice_specs[i].seconds * SOUND_RATE;
+		v->pos = v->len;
+		v->loop = voice_specs[i].loop;
+		synthesise(&voice_specs[i], p, v->len);
+		p += v->len;
+	}
+	core_regs regs;
+	core_get_regs(cpu, &regs);
+	dev->mixed = regs.cycles * SOUND_RATE / CLOCK_HZ; // sound starts now, e.g. after a boot cache
+	return 1;
+}
+
+void sound_free(sound_device* dev) {
+	free(dev->tables);
+	dev->tables = NULL;
+}
+
+// Puts n mixed samples into the ring, dropping what does not fit
+static void ring_write(sound_ring* ring, const int32_t* mix, uint32_t n, int on) {
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+	uint32_t space = SOUND_RING_SIZE - (head - tail);
+	uint32_t k = n < space ? n : space;
+	for (uint32_t i = 0; i < k; i++) {
+		int32_t v = on ? mix[i] : 0;
+		ring->samples[(head + i) & RING_MASK] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+	}
+	atomic_store_explicit(&ring->head, head + k, memory_order_release);
+	ring->dropped += n - k;
+}
+
+// Mixes the playing voices into the ring a block at a time until sample number until
+static void render(sound_device* dev, uint64_t until) {
+	int32_t mix[SOUND_BLOCK];
+	while (dev->mixed < until) {
+		uint32_t n = until - dev->mixed < SOUND_BLOCK ? until - dev->mixed : SOUND_BLOCK;
+		memset(mix, 0, n * sizeof(int32_t));
+		for (int i = 0; i < SOUND_VOICES; i++) {
+			sound_voice* v = &dev->voices[i];
+			for (uint32_t j = 0; j < n && v->pos < v->len; j++) {
+				mix[j] += v->data[v->pos++];
+				if (v->pos == v->len && v->loop) {
+					v->pos = 0;
+				}
+			}
+		}
+		ring_write(&dev->ring, mix, n, dev->port3 & AMP_ENABLE);
+		dev->mixed += n;
+	}
+}
+
+// Starts the voices whose bits rise and stops the looping ones whose bits fall
+static void edges(sound_voice* voices, uint8_t old, uint8_t v) {
+	for (int bit = 0; bit < 5; bit++) {
+		uint8_t mask = 1 << bit;
+		if ((v & mask) && !(old & mask)) {
+			voices[bit].pos = 0;
+		} else if (!(v & mask) && (old & mask) && voices[bit].loop) {
+			voices[bit].pos = voices[bit].len;
+		}
+	}
+}
+
+void sound_out(void* user, uint8_t port, uint8_t v) {
+	sound_device* dev = user;
+	if (port != 3 && port != 5) {
+		return;
+	}
+	core_regs regs;
+	core_get_regs(dev->cpu, &regs);
+	render(dev, regs.cycles * SOUND_RATE / CLOCK_HZ); // everything before the write sounds as it was
+	if (port == 3) {
+		edges(&dev->voices[0], dev->port3, v);
+		dev->port3 = v;
+	} else {
+		edges(&dev->voices[5], dev->port5, v);
+		dev->port5 = v;
+	}
+}
+
+void sound_update(sound_device* dev) {
+	core_regs regs;
+	core_get_regs(dev->cpu, &regs);
+	render(dev, regs.cycles * SOUND_RATE / CLOCK_HZ);
+}
+
+uint32_t sound_ring_read(sound_ring* ring, int16_t* out, uint32_t max) {
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	uint32_t n = head - tail < max ? head - tail : max;
+	for (uint32_t i = 0; i < n; i++) {
+		out[i] = ring->samples[(tail + i) & RING_MASK];
+	}
+	atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+	return n;
+}
+
+/* -------------- WAV FILES -------------- */
+
+static void put_le(uint8_t* p, uint32_t v, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		p[i] = (v >> (8 * i)) & 0xff;
+	}
+}
+
+// Writes the 44 byte header for a file of samples samples
+static int write_header(FILE* fp, uint64_t samples) {
+	uint32_t data = samples * 2;
+	uint8_t h[44];
+	memcpy(h, "RIFF", 4);
+	put_le(h + 4, 36 + data, 4);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_le(h + 16, 16, 4); // size of the fmt chunk
+	put_le(h + 20, 1, 2); // PCM
+	put_le(h + 22, 1, 2); // mono
+	put_le(h + 24, SOUND_RATE, 4);
+	put_le(h + 28, SOUND_RATE * 2, 4); // bytes per second
+	put_le(h + 32, 2, 2); // bytes per sample
+	put_le(h + 34, 16, 2); // bits per sample
+	memcpy(h + 36, "data", 4);
+	put_le(h + 40, data, 4);
+	return fwrite(h, sizeof(h), 1, fp) == 1;
+}
+
+int wav_open(wav_writer* wav, const char* path) {
+	memset(wav, 0, sizeof(*wav));
+	wav->fp = fopen(path, "wb");
+	if (wav->fp == NULL) {
+		return 0;
+	}
+	wav->failed = !write_header(wav->fp, 0); // the sizes are filled in by wav_close
+	return 1;
+}
+
+void wav_drain(wav_writer* wav, sound_ring* ring) {
+	int16_t buf[SOUND_BLOCK];
+	uint8_t bytes[SOUND_BLOCK * 2];
+	uint32_t n;
+	while ((n = sound_ring_read(ring, buf, SOUND_BLOCK)) > 0) {
+		for (uint32_t i = 0; i < n; i++) {
+			put_le(bytes + 2 * i, (uint16_t) buf[i], 2);
+		}
+		if (fwrite(bytes, 2, n, wav->fp) != n) {
+			wav->failed = 1;
+		}
+		wav->samples += n;
+	}
+}
+
+int wav_close(wav_writer* wav) {
+	if (fseek(wav->fp, 0, SEEK_SET) != 0 || !write_header(wav->fp, wav->samples)) {
+		wav->failed = 1;
+	}
+	wav->failed |= fclose(wav->fp) != 0;
+	wav->fp = NULL;
+	return !wav->failed;
+}
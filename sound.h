@@ -0,0 +1,69 @@
+#ifndef SOUND_H
+#define SOUND_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include "core.h"
+
+#define SOUND_RATE 44100 // samples per second, mono
+#define SOUND_RING_SIZE 16384 // samples the ring holds, a power of 2 (about 370ms)
+#define SOUND_BLOCK 512 // samples mixed at a time
+#define SOUND_VOICES 10
+
+// Single producer, single consumer ring of samples. The emulator thread mixes into it and one
+// consumer (an audio callback or wav_drain) takes them out, without locks. When the consumer falls
+// behind, new samples are dropped rather than queued, so a paced consumer never sees more latency
+// than the ring holds
+typedef struct sound_ring {
+	int16_t samples[SOUND_RING_SIZE];
+	_Atomic uint32_t head; // samples written, only the producer stores it
+	_Atomic uint32_t tail; // samples read, only the consumer stores it
+	uint64_t dropped; // samples that did not fit, counted by the producer
+} sound_ring;
+
+typedef struct sound_voice { // one of the Space Invaders sounds
+	const int16_t* data;
+	uint32_t len; // samples in data
+	uint32_t pos; // next sample to play, len when silent
+	uint8_t loop; // plays for as long as its port bit is set
+} sound_voice;
+
+typedef struct sound_device { // the Space Invaders sound board, fed by OUT 3 and OUT 5
+	core* cpu; // the machine whose cycle counter timestamps the port writes
+	uint8_t port3, port5; // last values written
+	uint64_t mixed; // samples rendered since reset
+	sound_voice voices[SOUND_VOICES];
+	int16_t* tables; // sample data of all voices
+	sound_ring ring;
+} sound_device;
+
+// Sets up a sound device for cpu, synthesising its samples. Returns 0 if out of memory
+int sound_init(sound_device* dev, core* cpu);
+void sound_free(sound_device* dev);
+
+// core_io out callback taking a sound_device as user. Ports 3 and 5 start and stop the sounds at
+// the sample matching the cycle count of the write, other ports are ignored
+void sound_out(void* user, uint8_t port, uint8_t v);
+
+// Mixes all sound up to the machine's current cycle count into the ring, call it once a frame or so
+void sound_update(sound_device* dev);
+
+// Takes up to max samples out of the ring, returns how many were taken
+uint32_t sound_ring_read(sound_ring* ring, int16_t* out, uint32_t max);
+
+typedef struct wav_writer { // 16 bit mono WAV file at SOUND_RATE
+	FILE* fp;
+	uint64_t samples;
+	int failed;
+} wav_writer;
+
+// Creates the WAV file at path, returns 0 on failure
+int wav_open(wav_writer* wav, const char* path);
+
+// Writes everything in ring to the file
+void wav_drain(wav_writer* wav, sound_ring* ring);
+
+// Fills in the sizes in the header and closes the file, returns 0 if any write failed
+int wav_close(wav_writer* wav);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "stats.h"
+
+#define UNIX_PREFIX "unix:"
+
+// Returns host monotonic time in seconds
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int stats_start(stats_recorder* rec, hw_state* state, const char* path, double interval) {
+	memset(rec, 0, sizeof(*rec));
+	rec->state = state;
+	rec->path = path;
+	rec->interval = path ? interval : 0;
+	rec->sock = -1;
+	rec->start = rec->last_dump = rec->frame_start = now();
+	rec->last_cycles = state->cycles;
+	if (path != NULL && strncmp(path, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0) {
+		rec->sock = socket(AF_UNIX, SOCK_DGRAM, 0);
+		return rec->sock >= 0;
+	}
+	return 1;
+}
+
+void stats_stop(stats_recorder* rec) {
+	if (rec->sock >= 0) {
+		close(rec->sock);
+		rec->sock = -1;
+	}
+}
+
+void stats_read(stats_recorder* rec, emu_stats* out) {
+	hw_state* state = rec->state;
+	double t = now();
+	double elapsed = t - rec->last_dump;
+	out->instructions = state->counters.instructions;
+	out->cycles = state->cycles;
+	out->interrupts = state->counters.interrupts;
+	out->port_reads = state->counters.port_reads;
+	out->port_writes = state->counters.port_writes;
+	out->frames = rec->frames;
+	out->seconds = t - rec->start;
+	out->mhz = elapsed > 0 ? (state->cycles - rec->last_cycles) / elapsed / 1e6 : 0;
+	out->frame_ms_avg = rec->interval_frames ? rec->interval_frame_ms / rec->interval_frames : 0;
+	out->frame_ms_max = rec->interval_frame_ms_max;
+}
+
+int stats_format(const emu_stats* stats, char* buf, size_t len) {
+	return snprintf(buf, len,
+		"instructions %llu\n"
+		"cycles %llu\n"
+		"interrupts %llu\n"
+		"port_reads %llu\n"
+		"port_writes %llu\n"
+		"frames %llu\n"
+		"seconds %.3f\n"
+		"mhz %.3f\n"
+		"frame_ms_avg %.3f\n"
+		"frame_ms_max %.3f\n",
+		(unsigned long long) stats->instructions, (unsigned long long) stats->cycles,
+		(unsigned long long) stats->interrupts, (unsigned long long) stats->port_reads,
+		(unsigned long long) stats->port_writes, (unsigned long long) stats->frames,
+		stats->seconds, stats->mhz, stats->frame_ms_avg, stats->frame_ms_max);
+}
+
+// Sends the len bytes of text to the recorder's destination, returns 1 on success
+static int write_stats(stats_recorder* rec, const char* text, int len) {
+	if (rec->sock >= 0) {
+		struct sockaddr_un addr = {.sun_family = AF_UNIX};
+		strncpy(addr.sun_path, rec->path + strlen(UNIX_PREFIX), sizeof(addr.sun_path) - 1);
+		return sendto(rec->sock, text, len, 0, (struct sockaddr*) &addr, sizeof(addr)) == len;
+	}
+	// rewrite the file through a rename so readers always see a complete dump
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", rec->path, (long) getpid());
+	FILE* fp = fopen(tmp_path, "w");
+	if (fp == NULL) {
+		return 0;
+	}
+	int ok = fwrite(text, 1, len, fp) == (size_t) len;
+	ok = (fclose(fp) == 0) && ok;
+	if (!ok || rename(tmp_path, rec->path) != 0) {
+		remove(tmp_path);
+		return 0;
+	}
+	return 1;
+}
+
+int stats_dump(stats_recorder* rec) {
+	char text[512];
+	stats_read(rec, &rec->last);
+	int len = stats_format(&rec->last, text, sizeof(text));
+	int ok = rec->path == NULL || write_stats(rec, text, len);
+	rec->last_dump = now();
+	rec->last_cycles = rec->state->cycles;
+	rec->interval_frames = 0;
+	rec->interval_frame_ms = 0;
+	rec->interval_frame_ms_max = 0;
+	return ok;
+}
+
+void stats_poll(stats_recorder* rec) {
+	if (rec->interval > 0 && now() - rec->last_dump >= rec->interval) {
+		stats_dump(rec);
+	}
+}
+
+void stats_frame(stats_recorder* rec) {
+	double t = now();
+	double ms = (t - rec->frame_start) * 1000;
+	rec->frame_start = t;
+	rec->frames++;
+	rec->interval_frames++;
+	rec->interval_frame_ms += ms;
+	if (ms > rec->interval_frame_ms_max) {
+		rec->interval_frame_ms_max = ms;
+	}
+	if (rec->interval > 0 && t - rec->last_dump >= rec->interval) {
+		stats_dump(rec);
+	}
+}
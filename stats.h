@@ -0,0 +1,54 @@
+#ifndef STATS_H
+#define STATS_H
+#include "emulator.h"
+
+typedef struct emu_stats { // snapshot of an emulator's performance counters
+	uint64_t instructions; // instructions retired
+	uint64_t cycles; // emulated clock cycles
+	uint64_t interrupts; // interrupts delivered
+	uint64_t port_reads;
+	uint64_t port_writes;
+	uint64_t frames; // video frames completed
+	double seconds; // host time since stats_start
+	double mhz; // emulated clock rate since the previous dump
+	double frame_ms_avg; // host time per frame since the previous dump
+	double frame_ms_max;
+} emu_stats;
+
+typedef struct stats_recorder { // host-side timing and periodic dumping of stats for one emulator
+	hw_state* state;
+	const char* path; // file to rewrite on each dump, or unix:PATH for a datagram socket
+	int sock; // socket for unix: destinations, -1 otherwise
+	double interval; // seconds between dumps, 0 to never dump
+	double start; // host time when recording started
+	double last_dump;
+	uint64_t last_cycles; // cycles at the previous dump
+	double frame_start; // host time the current frame started
+	uint64_t frames;
+	uint64_t interval_frames; // frames since the previous dump
+	double interval_frame_ms; // total host time of those frames
+	double interval_frame_ms_max;
+	emu_stats last; // the most recent snapshot
+} stats_recorder;
+
+// Starts recording stats for state, dumping them to path every interval seconds (path may be NULL)
+// Returns 0 if the unix socket destination could not be created
+int stats_start(stats_recorder* rec, hw_state* state, const char* path, double interval);
+void stats_stop(stats_recorder* rec);
+
+// Records the end of a video frame, and dumps the stats if the interval has elapsed
+void stats_frame(stats_recorder* rec);
+
+// Dumps the stats if the interval has elapsed, for callers that are not frame driven
+void stats_poll(stats_recorder* rec);
+
+// Fills out with the current counters
+void stats_read(stats_recorder* rec, emu_stats* out);
+
+// Writes stats as "name value" lines to buf, returns the length written
+int stats_format(const emu_stats* stats, char* buf, size_t len);
+
+// Sends the current stats to the recorder's destination now, returns 1 on success
+int stats_dump(stats_recorder* rec);
+
+#endif
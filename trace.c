@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+
+// Writes the buffered records to the file
+static void flush(trace_recorder* rec) {
+	size_t done = 0;
+	while (done < rec->len && !rec->failed) {
+		ssize_t n = write(rec->fd, rec->buf + done, rec->len - done);
+		if (n <= 0) {
+			rec->failed = 1;
+		} else {
+			done += n;
+		}
+	}
+	rec->len = 0;
+}
+
+int trace_open(trace_recorder* rec, hw_state* state, const char* path) {
+	memset(rec, 0, sizeof(*rec));
+	rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (rec->fd < 0) {
+		return 0;
+	}
+	rec->buf = malloc(TRACE_BUFFER);
+	uint8_t* p = rec->buf;
+	memcpy(p, TRACE_MAGIC, 8);
+	p[8] = TRACE_VERSION & 0xff;
+	p[9] = (TRACE_VERSION >> 8) & 0xff;
+	p[10] = (TRACE_VERSION >> 16) & 0xff;
+	p[11] = TRACE_VERSION >> 24;
+	memset(p + 12, 0, 4);
+	rec->len = TRACE_HEADER_SIZE;
+	for (int page = 0; page < NUM_PAGES; page++) {
+		state->slow_pages[page] |= PAGE_TRACE; // every write has to be seen
+	}
+	state->recorder = rec;
+	return 1;
+}
+
+void trace_step(trace_recorder* rec, hw_state* state) {
+	if (rec->len + TRACE_STEP_SIZE > TRACE_BUFFER) {
+		flush(rec);
+	}
+	uint8_t* p = rec->buf + rec->len;
+	uint16_t pc = state->op_pc;
+	p[0] = TRACE_STEP;
+	p[1] = pc & 0xff;
+	p[2] = pc >> 8;
+	p[3] = state->memory[pc];
+	p[4] = state->memory[(uint16_t) (pc + 1)];
+	p[5] = state->memory[(uint16_t) (pc + 2)];
+	p[6] = state->a;
+	p[7] = state->b;
+	p[8] = state->c;
+	p[9] = state->d;
+	p[10] = state->e;
+	p[11] = state->h;
+	p[12] = state->l;
+	p[13] = get_psw(state) & 0xff;
+	p[14] = state->sp & 0xff;
+	p[15] = state->sp >> 8;
+	rec->len += TRACE_STEP_SIZE;
+	rec->steps++;
+}
+
+void trace_write(trace_recorder* rec, uint16_t adr, uint8_t v) {
+	if (rec->len + TRACE_WRITE_SIZE > TRACE_BUFFER) {
+		flush(rec);
+	}
+	uint8_t* p = rec->buf + rec->len;
+	p[0] = TRACE_WRITE;
+	p[1] = adr & 0xff;
+	p[2] = adr >> 8;
+	p[3] = v;
+	rec->len += TRACE_WRITE_SIZE;
+}
+
+int trace_close(trace_recorder* rec, hw_state* state) {
+	flush(rec);
+	if (close(rec->fd) != 0) {
+		rec->failed = 1;
+	}
+	free(rec->buf);
+	rec->buf = NULL;
+	for (int page = 0; page < NUM_PAGES; page++) {
+		state->slow_pages[page] &= ~PAGE_TRACE;
+	}
+	state->recorder = NULL;
+	return !rec->failed;
+}
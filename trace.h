@@ -0,0 +1,48 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+#include <stddef.h>
+#include "emulator.h"
+
+// A binary execution trace is a 16 byte header followed by one record per executed instruction,
+// each preceded by a record for every memory write it made. All values are little endian.
+//
+//   header  "8080TRAC", uint32 version, uint32 reserved (0)
+//   step    tag 1, pc (2), opcode bytes (3), a, b, c, d, e, h, l, flags, sp (2)      16 bytes
+//   write   tag 2, address (2), value                                               4 bytes
+//
+// pc and the opcode bytes are those of the instruction, the registers are as it left them and
+// flags is the low byte of the PSW. Two runs of the same program can be compared with tracediff
+
+#define TRACE_MAGIC "8080TRAC"
+#define TRACE_VERSION 1
+#define TRACE_HEADER_SIZE 16
+#define TRACE_STEP 1
+#define TRACE_STEP_SIZE 16
+#define TRACE_WRITE 2
+#define TRACE_WRITE_SIZE 4
+#define TRACE_BUFFER (1 << 20) // records are written out in blocks of this size
+
+typedef struct trace_recorder { // a trace being written
+	int fd;
+	uint8_t* buf;
+	size_t len; // bytes waiting in buf
+	int failed; // set if a write to the file failed
+	uint64_t steps; // step records written
+} trace_recorder;
+
+// Creates the trace file at path and starts recording every instruction state executes and every
+// write it makes to memory. Returns 0 if the file could not be created
+int trace_open(trace_recorder* rec, hw_state* state, const char* path);
+
+// Appends a step record for the instruction state has just executed, called by emulate
+void trace_step(trace_recorder* rec, hw_state* state);
+
+// Appends a write record, called by the memory slow path for traced pages
+void trace_write(trace_recorder* rec, uint16_t adr, uint8_t v);
+
+// Writes out the buffered records, closes the file and detaches the recorder from state. Returns
+// 0 if any part of the trace could not be written
+int trace_close(trace_recorder* rec, hw_state* state);
+
+#endif
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "trace.h"
+#include "decode.h"
+
+#define DIFF_CONTEXT 8 // instructions printed before the first difference
+#define DIFF_WRITES 16 // write records looked through for the instruction that made them
+
+typedef struct trace_file { // one of the two traces being compared
+	const char* path;
+	int fd;
+	uint8_t* buf; // TRACE_BUFFER bytes of the file, starting at the same offset for both traces
+} trace_file;
+
+// Reads up to len bytes, stopping early only at the end of the file. Returns the number of bytes
+// read or -1 on error
+static ssize_t read_full(int fd, uint8_t* buf, size_t len) {
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = read(fd, buf + done, len - done);
+		if (n < 0) {
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+		done += n;
+	}
+	return done;
+}
+
+// Opens the trace at path and checks its header, returns 0 with a message if it is not a trace
+static int open_trace(trace_file* t, const char* path) {
+	t->path = path;
+	t->fd = open(path, O_RDONLY);
+	if (t->fd < 0) {
+		printf("Could not open file %s\n", path);
+		return 0;
+	}
+	posix_fadvise(t->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	uint8_t header[TRACE_HEADER_SIZE];
+	if (read_full(t->fd, header, TRACE_HEADER_SIZE) != TRACE_HEADER_SIZE || memcmp(header, TRACE_MAGIC, 8) != 0) {
+		printf("%s is not a trace\n", path);
+		return 0;
+	}
+	uint32_t version = header[8] | (header[9] << 8) | (header[10] << 16) | ((uint32_t) header[11] << 24);
+	if (version != TRACE_VERSION) {
+		printf("%s is a version %u trace, expected version %d\n", path, version, TRACE_VERSION);
+		return 0;
+	}
+	t->buf = malloc(TRACE_BUFFER);
+	return 1;
+}
+
+// Returns the size of records with the given tag, 0 if the tag is not valid
+static int record_size(uint8_t tag) {
+	switch (tag) {
+		case TRACE_STEP: return TRACE_STEP_SIZE;
+		case TRACE_WRITE: return TRACE_WRITE_SIZE;
+	}
+	return 0;
+}
+
+// Prints the record at offset off of the trace as one line. Returns its size, or 0 if the trace
+// ends there or the record is cut off or corrupt
+static int print_record(trace_file* t, const char* side, uint64_t off, uint64_t instruction) {
+	uint8_t rec[TRACE_STEP_SIZE];
+	ssize_t n = pread(t->fd, rec, sizeof(rec), off);
+	if (n <= 0) {
+		printf("%s %10llu (end of trace)\n", side, (unsigned long long) instruction);
+		return 0;
+	}
+	int size = record_size(rec[0]);
+	if (size == 0 || n < size) {
+		printf("%s %10llu (%s record at offset %llu)\n", side, (unsigned long long) instruction,
+			size == 0 ? "corrupt" : "cut off", (unsigned long long) off);
+		return 0;
+	}
+	if (rec[0] == TRACE_WRITE) {
+		printf("%s %10llu                  write %02X%02X = %02X\n", side, (unsigned long long) instruction, rec[2], rec[1], rec[3]);
+	} else {
+		char text[32];
+		format_op(text, sizeof(text), &rec[3], 0);
+		printf("%s %10llu %02X%02X  %02X %02X %02X  %-14s A=%02X BC=%02X%02X DE=%02X%02X HL=%02X%02X SP=%02X%02X F=%02X\n",
+			side, (unsigned long long) instruction, rec[2], rec[1], rec[3], rec[4], rec[5], text,
+			rec[6], rec[7], rec[8], rec[9], rec[10], rec[11], rec[12], rec[15], rec[14], rec[13]);
+	}
+	return size;
+}
+
+// Prints the record at off and, if it is a write, the records up to the instruction that made it
+static void print_divergence(trace_file* t, const char* side, uint64_t off, uint64_t instruction) {
+	for (int i = 0; i < DIFF_WRITES; i++) {
+		uint8_t tag;
+		if (pread(t->fd, &tag, 1, off) != 1 || tag != TRACE_WRITE) {
+			print_record(t, side, off, instruction);
+			return;
+		}
+		off += print_record(t, side, off, instruction);
+	}
+}
+
+// Compares the traces a and b a block at a time, tracking record boundaries so the first
+// difference can be shown in context. Returns 0 if they match, 1 if they differ and 2 on error
+static int diff(trace_file* a, trace_file* b) {
+	uint64_t pos = TRACE_HEADER_SIZE; // offset of the start of the buffers
+	uint64_t next = pos; // offset of the next record
+	uint64_t last = next; // offset of the record before next
+	int last_step = 0; // whether that record is a step
+	uint64_t steps = 0; // step records before next
+	uint64_t recent[DIFF_CONTEXT]; // offsets of the last step records
+	for (;;) {
+		ssize_t na = read_full(a->fd, a->buf, TRACE_BUFFER);
+		ssize_t nb = read_full(b->fd, b->buf, TRACE_BUFFER);
+		if (na < 0 || nb < 0) {
+			printf("Could not read %s\n", na < 0 ? a->path : b->path);
+			return 2;
+		}
+		size_t n = na < nb ? na : nb;
+		size_t same = n;
+		if (memcmp(a->buf, b->buf, n) != 0) {
+			for (same = 0; a->buf[same] == b->buf[same]; same++);
+		}
+		int diverged = same < n || na != nb;
+
+		// step over the records starting in the matching bytes, stopping at the one that differs
+		uint64_t end = pos + same;
+		while (next < end) {
+			uint8_t tag = a->buf[next - pos];
+			int size = record_size(tag);
+			if (size == 0) {
+				printf("%s: corrupt record at offset %llu\n", a->path, (unsigned long long) next);
+				return 2;
+			}
+			if (diverged && next + size > end) {
+				break;
+			}
+			if (tag == TRACE_STEP) {
+				recent[steps % DIFF_CONTEXT] = next;
+				steps++;
+			}
+			last = next;
+			last_step = tag == TRACE_STEP;
+			next += size;
+		}
+
+		if (diverged) {
+			if (next > end) { // the record that differs began in the previous block
+				steps -= last_step;
+				next = last;
+			}
+			uint64_t first = steps > DIFF_CONTEXT ? steps - DIFF_CONTEXT : 0;
+			for (uint64_t i = first; i < steps; i++) {
+				print_record(a, " ", recent[i % DIFF_CONTEXT], i + 1);
+			}
+			printf("first difference in instruction %llu, offset %llu\n", (unsigned long long) steps + 1, (unsigned long long) next);
+			print_divergence(a, "<", next, steps + 1);
+			print_divergence(b, ">", next, steps + 1);
+			return 1;
+		}
+		if (n == 0) {
+			printf("traces match, %llu instructions\n", (unsigned long long) steps);
+			return 0;
+		}
+		pos += n;
+	}
+}
+
+// Compares two traces written with -trace-out and prints where they first differ
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		printf("Usage: tracediff TRACE TRACE\n");
+		return 2;
+	}
+	trace_file a = {0}, b = {0};
+	if (!open_trace(&a, argv[1]) || !open_trace(&b, argv[2])) {
+		return 2;
+	}
+	int result = diff(&a, &b);
+	free(a.buf);
+	free(b.buf);
+	close(a.fd);
+	close(b.fd);
+	return result;
+}
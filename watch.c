@@ -0,0 +1,95 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "watch.h"
+
+void watch_init(watch_list* list, hw_state* state, FILE* out) {
+	memset(list, 0, sizeof(*list));
+	list->out = out;
+	state->watch = list;
+}
+
+int watch_add(watch_list* list, hw_state* state, uint16_t start, uint16_t end, int type) {
+	if (list->num_points == WATCH_MAX) {
+		return 0;
+	}
+	list->points[list->num_points++] = (watchpoint) {.start = start, .end = end, .type = type};
+	for (int page = start >> 8; page <= end >> 8; page++) {
+		state->slow_pages[page] |= PAGE_WATCH;
+	}
+	return 1;
+}
+
+void watch_clear(watch_list* list, hw_state* state) {
+	list->num_points = 0;
+	for (int page = 0; page < NUM_PAGES; page++) {
+		state->slow_pages[page] &= ~PAGE_WATCH;
+	}
+}
+
+int watch_parse(const char* spec, uint16_t* start, uint16_t* end, int* type) {
+	char* p;
+	long v = strtol(spec, &p, 16);
+	if (p == spec || v < 0 || v >= MEMORY_SIZE) {
+		return 0;
+	}
+	*start = *end = v;
+	if (*p == '-') {
+		const char* q = p + 1;
+		v = strtol(q, &p, 16);
+		if (p == q || v < *start || v >= MEMORY_SIZE) {
+			return 0;
+		}
+		*end = v;
+	}
+	*type = WATCH_WRITE;
+	if (*p == ':') {
+		p++;
+		*type = 0;
+		for (; *p == 'r' || *p == 'w'; p++) {
+			*type |= *p == 'r' ? WATCH_READ : WATCH_WRITE;
+		}
+	}
+	return *p == '\0' && *type != 0;
+}
+
+// Copies the innermost return addresses of the core's shadow call stack into hit, skipping calls
+// whose return address SP has already moved past (e.g. a stack reset by LXI SP)
+static void find_callers(hw_state* state, watch_hit* hit) {
+	hit->depth = 0;
+	for (int i = state->call_depth - 1; i >= 0 && hit->depth < WATCH_STACK_DEPTH; i--) {
+		if (state->call_sp[i] >= state->sp) {
+			hit->stack[hit->depth++] = state->call_stack[i];
+		}
+	}
+}
+
+void watch_access(hw_state* state, uint16_t adr, int type, uint8_t old_value, uint8_t new_value) {
+	watch_list* list = state->watch;
+	for (int i = 0; i < list->num_points; i++) {
+		watchpoint* w = &list->points[i];
+		if ((w->type & type) && adr >= w->start && adr <= w->end) {
+			watch_hit* hit = &list->last;
+			hit->pc = state->op_pc;
+			hit->adr = adr;
+			hit->type = type;
+			hit->old_value = old_value;
+			hit->new_value = new_value;
+			find_callers(state, hit);
+			list->hits++;
+			if (list->out != NULL) {
+				watch_print(hit, list->out);
+			}
+			return;
+		}
+	}
+}
+
+void watch_print(const watch_hit* hit, FILE* out) {
+	fprintf(out, "watch %s %04X at PC %04X: %02X -> %02X, stack:", hit->type == WATCH_READ ? "read" : "write",
+		hit->adr, hit->pc, hit->old_value, hit->new_value);
+	for (int i = 0; i < hit->depth; i++) {
+		fprintf(out, " %04X", hit->stack[i]);
+	}
+	fprintf(out, "%s\n", hit->depth ? "" : " (none)");
+}
@@ -0,0 +1,56 @@
+#ifndef WATCH_H
+#define WATCH_H
+#include <stdio.h>
+#include "emulator.h"
+
+#define WATCH_MAX 64 // watchpoints per machine
+#define WATCH_STACK_DEPTH 8 // return addresses reported with each hit
+
+#define WATCH_READ 1
+#define WATCH_WRITE 2
+
+typedef struct watchpoint { // a watched range of guest addresses
+	uint16_t start;
+	uint16_t end; // inclusive
+	uint8_t type; // WATCH_READ and/or WATCH_WRITE
+} watchpoint;
+
+typedef struct watch_hit { // one access to a watched address
+	uint16_t pc; // instruction making the access
+	uint16_t adr;
+	uint8_t type; // WATCH_READ or WATCH_WRITE
+	uint8_t old_value;
+	uint8_t new_value; // same as old_value for reads
+	int depth; // entries in stack
+	uint16_t stack[WATCH_STACK_DEPTH]; // return addresses of the active guest calls and interrupts, innermost first
+} watch_hit;
+
+typedef struct watch_list { // the watchpoints of one machine
+	watchpoint points[WATCH_MAX];
+	int num_points;
+	FILE* out; // each hit is printed here, NULL to only count them
+	uint64_t hits;
+	watch_hit last; // the most recent hit
+} watch_list;
+
+// Attaches an empty watch list to state, hits are printed to out
+void watch_init(watch_list* list, hw_state* state, FILE* out);
+
+// Watches accesses of the given type to start..end (inclusive). Only the 256-byte pages holding
+// the range are routed to the slow path. Returns 0 if the list is full
+int watch_add(watch_list* list, hw_state* state, uint16_t start, uint16_t end, int type);
+
+// Removes every watchpoint and puts all pages back on the fast path
+void watch_clear(watch_list* list, hw_state* state);
+
+// Records an access to a watched page if a watchpoint of that type covers adr, called by the
+// memory slow path when state->watch is set
+void watch_access(hw_state* state, uint16_t adr, int type, uint8_t old_value, uint8_t new_value);
+
+// Parses ADDR, ADDR-END or either followed by :r, :w or :rw (hex, default :w), returns 1 if valid
+int watch_parse(const char* spec, uint16_t* start, uint16_t* end, int* type);
+
+// Prints hit as one line: type, address, PC, old and new values and the guest call stack
+void watch_print(const watch_hit* hit, FILE* out);
+
+#endif